@@ -10,29 +10,145 @@ namespace dht {
 class routing_table;
 class network;
 
-class bucket : public std::list<routing_table_entry> {
+/// @brief a net_addr in 20 bytes, how buckets hold addresses.
+/// IPv4 is kept v4-mapped so every address compares the same way. only IP literals fit,
+/// a hostname is dropped when it would be added to a bucket
+struct packed_addr {
+    std::array<u8, 16> ip;
+    u16 port;
+    u8 transport;
+    u8 pad;
+
+    packed_addr() : ip(), port(0), transport(0), pad(0) { }
+
+    /// @brief false if `a` isn't an IP literal
+    static bool pack(const net_addr& a, packed_addr& r) {
+        boost::system::error_code ec;
+        boost::asio::ip::address ip = boost::asio::ip::make_address(a.addr, ec);
+        if(ec) return false;
+
+        r.ip = ip.is_v4() ?
+            boost::asio::ip::make_address_v6(boost::asio::ip::v4_mapped, ip.to_v4()).to_bytes() :
+            ip.to_v6().to_bytes();
+        r.port = a.port;
+        r.transport = static_cast<u8>(a.transport_type);
+        r.pad = 0;
+
+        return true;
+    }
+
+    net_addr unpack() const {
+        net_addr r;
+        r.transport_type = static_cast<decltype(r.transport_type)>(transport);
+        r.port = port;
+
+        static const u8 v4_prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+        if(std::memcmp(ip.data(), v4_prefix, sizeof(v4_prefix)) != 0) {
+            r.addr = boost::asio::ip::address_v6(ip).to_string();
+            return r;
+        }
+
+        // dotted quad by hand, the asio round trip costs more than the rest of a lookup
+        char buf[16];
+        char* p = buf;
+
+        for(int i = 12; i < 16; i++) {
+            unsigned v = ip[i];
+            if(v >= 100) *p++ = '0' + v / 100;
+            if(v >= 10) *p++ = '0' + v / 10 % 10;
+            *p++ = '0' + v % 10;
+            *p++ = '.';
+        }
+
+        r.addr.assign(buf, p - 1);
+        return r;
+    }
+
+    bool operator==(const packed_addr& rhs) const {
+        return std::memcmp(this, &rhs, sizeof(packed_addr)) == 0;
+    }
+};
+
+static_assert(sizeof(packed_addr) == 20, "packed_addr must be 20 bytes");
+
+/// @brief a k-bucket of fixed capacity, laid out as parallel arrays so an ID scan only
+/// touches the IDs. an entry keeps its slot until one is erased, then the last slot moves
+/// into the hole. `order` holds the slots from least to most recently seen, public indices
+/// are positions in that order
+class bucket {
 public:
+    static const int k = proto::bucket_size;
+    static const int addr_limit = proto::table_entry_addr_limit;
+
+    bucket();
     bucket(std::shared_ptr<routing_table>);
-    
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear() { count = 0; }
+
+    /// @brief position of `id`, -1 if it isn't here
+    int find(const hash_t&) const;
+
+    const hash_t& id(int i) const { return ids[order[i]]; }
+    const rtt_estimator& rtt(int i) const { return rtts[order[i]]; }
+    routing_table_entry entry(int) const;
+    net_contact contact(int) const;
+
+    /// @brief false once every address of the entry has missed too many pings
+    bool live(int) const;
+
+    /// @brief add an entry as most recently seen. false if the bucket is full or the entry has no usable address
+    bool insert(const routing_table_entry&);
+    void sample(net_peer, milliseconds);
+
     void update(net_peer, bool);
     void update_near_entry(net_peer);
     void update_far_entry(net_peer);
     void add_new(net_peer);
 
     void responded(net_peer);
+
+    /// @brief count a miss against the address. an address that misses too often is dropped,
+    /// and an entry that loses its last address is erased and its slot offered to the cache
     void stale(net_peer);
 
     void update_cache(net_peer);
 
     u64 last_seen;
     std::size_t max_size;
+
+    // IDs in this bucket share their first `cutoff` bits with `prefix`
+    hash_t prefix;
+    int cutoff;
+
     std::shared_ptr<routing_table> table;
 
     std::list<net_peer> cache;
     std::mutex cache_mutex;
+
+private:
+    int slot(const hash_t&) const;
+    int position(int) const;
+    int address(int, const packed_addr&) const;
+    int add(const hash_t&, const packed_addr&);
+    void add_address(int, const packed_addr&);
+    void erase(int);
+    void touch(int);
+    void promote();
+
+    hash_t ids[k];
+    rtt_estimator rtts[k];
+    u8 n_addrs[k];
+    packed_addr addrs[k][addr_limit];
+    u8 misses[k][addr_limit];
+
+    u8 order[k];
+    u8 count;
 };
 
 }
 }
 
-#endif
\ No newline at end of file
+#endif
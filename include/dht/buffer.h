@@ -0,0 +1,108 @@
+#ifndef _BUFFER_H
+#define _BUFFER_H
+
+#include "util.hpp"
+
+namespace lotus {
+namespace dht {
+
+template <typename T> class buffer_pool;
+
+/// @brief a receive buffer. messages decoded from it reference its bytes and zone
+/// in place, so it stays out of the pool for as long as any of them are alive
+struct slab {
+    char data[proto::max_data_size];
+    std::size_t size;
+    msgpack::zone zone;
+    std::atomic<int> refs;
+    buffer_pool<slab>* pool;
+
+    slab(buffer_pool<slab>* p) : size(0), refs(0), pool(p) { }
+    void reset() { size = 0; zone.clear(); }
+};
+
+/// @brief a send buffer. messages are encoded straight into it and it goes back 
+/// to the pool from the send's completion handler
+struct send_buffer {
+    msgpack::sbuffer sb;
+    std::atomic<int> refs;
+    buffer_pool<send_buffer>* pool;
+
+    send_buffer(buffer_pool<send_buffer>* p) : refs(0), pool(p) { }
+    void reset() { sb.clear(); }
+};
+
+void intrusive_ptr_add_ref(slab*);
+void intrusive_ptr_release(slab*);
+void intrusive_ptr_add_ref(send_buffer*);
+void intrusive_ptr_release(send_buffer*);
+
+using slab_ref = boost::intrusive_ptr<slab>;
+using send_ref = boost::intrusive_ptr<send_buffer>;
+
+/// @brief fixed set of buffers reused across packets. 
+/// only grows if every buffer is still held
+template <typename T>
+class buffer_pool {
+public:
+    buffer_pool(std::size_t n) {
+        items.reserve(n);
+        free_list.reserve(n);
+
+        for(std::size_t i = 0; i < n; i++) {
+            items.emplace_back(new T(this));
+            free_list.push_back(items.back().get());
+        }
+    }
+
+    boost::intrusive_ptr<T> acquire() {
+        T* t = nullptr;
+
+        {
+            LOCK(mutex);
+
+            if(!free_list.empty()) {
+                t = free_list.back();
+                free_list.pop_back();
+            } else {
+                // everything is in use, grow rather than drop the packet
+                items.emplace_back(new T(this));
+                free_list.reserve(items.size());
+                t = items.back().get();
+
+                spdlog::debug("network: buffer pool exhausted, grew to {}", items.size());
+            }
+        }
+
+        t->reset();
+        return boost::intrusive_ptr<T>(t);
+    }
+
+    void release(T* t) {
+        LOCK(mutex);
+        free_list.push_back(t);
+    }
+
+    std::size_t available() {
+        LOCK(mutex);
+        return free_list.size();
+    }
+
+    std::size_t capacity() {
+        LOCK(mutex);
+        return items.size();
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<T*> free_list;
+    std::vector<std::unique_ptr<T>> items;
+};
+
+using slab_pool = buffer_pool<slab>;
+using send_pool = buffer_pool<send_buffer>;
+
+}
+}
+
+#endif
@@ -12,27 +12,158 @@ namespace pki {
 
 using namespace CryptoPP;
 
+enum key_scheme {
+    rsa = 0, // RSA-2048 PSS/SHA-256
+    ed25519 = 1 // Ed25519, schema version 1 and up
+};
+
 struct keypair {
     RSA::PublicKey pub_key;
     RSA::PrivateKey priv_key;
 };
 
+/// @brief a peer's public key, parsed once into a ready verifier. immutable and shared
+class public_key {
+public:
+    virtual ~public_key() { }
+
+    virtual key_scheme scheme() const = 0;
+    virtual bool verify(const std::string&, const std::string&) const = 0;
+
+    // detects the scheme from the encoded key
+    static std::shared_ptr<const public_key> load(const std::string&);
+};
+
+/// @brief our own signing key. each thread signs with its own signer, built from the key on first use
+class private_key {
+public:
+    virtual ~private_key() { }
+
+    virtual key_scheme scheme() const = 0;
+    virtual std::string pub_key() const = 0;
+    virtual std::shared_ptr<const public_key> public_part() const = 0;
+    virtual std::string sign(const std::string&) const = 0;
+    virtual void save(std::string, std::string) const = 0;
+
+    static std::unique_ptr<private_key> generate(key_scheme, RandomNumberGenerator&);
+    static std::unique_ptr<private_key> load(std::string, std::string);
+};
+
+/// @brief bounded set of (signer, message, signature) triples that already verified
+class verify_cache {
+public:
+    using digest = std::array<byte, SHA256::DIGESTSIZE>;
+
+    verify_cache(std::size_t);
+
+    static digest key(dht::hash_t, const std::string&, const std::string&);
+
+    bool contains(const digest&);
+    void insert(const digest&);
+
+    u64 hits() const { return n_hits; }
+    u64 misses() const { return n_misses; }
+    std::size_t size();
+
+private:
+    struct digest_hash {
+        std::size_t operator()(const digest& d) const {
+            std::size_t h;
+            std::memcpy(&h, d.data(), sizeof(h));
+            return h;
+        }
+    };
+
+    // oldest entries are evicted first
+    struct shard {
+        std::mutex mutex;
+        std::unordered_set<digest, digest_hash> set;
+        std::deque<digest> order;
+    };
+
+    shard& shard_for(const digest& d) { return shards[digest_hash()(d) % shards.size()]; }
+
+    std::size_t capacity;
+    std::array<shard, dht::proto::queue_shards> shards;
+
+    std::atomic<u64> n_hits;
+    std::atomic<u64> n_misses;
+};
+
+/// @brief bounded map of peer id -> public key, least recently used keys are evicted first.
+/// optionally backed by an append-only file of encoded keys so restarts start warm
+class keystore {
+public:
+    keystore(std::size_t);
+
+    // load keys from file and append new ones to it from now on, returns number of keys loaded
+    std::size_t open(const std::string&);
+
+    std::shared_ptr<const public_key> get(dht::hash_t);
+    bool has(dht::hash_t);
+    void put(dht::hash_t, std::string, std::shared_ptr<const public_key>);
+    void del(dht::hash_t);
+
+    std::size_t capacity() const { return shard_capacity * shards.size(); }
+    std::size_t size();
+    u64 hits() const { return n_hits; }
+    u64 misses() const { return n_misses; }
+    u64 evictions() const { return n_evictions; }
+
+private:
+    struct entry {
+        dht::hash_t id;
+        std::string encoded;
+        std::shared_ptr<const public_key> key;
+    };
+
+    // front is most recently used
+    struct shard {
+        std::mutex mutex;
+        std::list<entry> lru;
+        std::unordered_map<dht::hash_t, std::list<entry>::iterator> map;
+    };
+
+    shard& shard_for(dht::hash_t h) { return shards[std::hash<dht::hash_t>()(h) % shards.size()]; }
+    std::shared_ptr<const public_key> touch(shard&, dht::hash_t);
+    bool insert(dht::hash_t, std::string, std::shared_ptr<const public_key>);
+
+    // file is a sequence of records: u16 big endian length, encoded key. id = hash(key)
+    void append(const std::string&);
+    void compact();
+
+    std::size_t shard_capacity;
+    std::array<shard, dht::proto::queue_shards> shards;
+
+    std::mutex file_mutex;
+    std::string path;
+    std::ofstream file;
+    std::size_t records;
+
+    std::atomic<u64> n_hits;
+    std::atomic<u64> n_misses;
+    std::atomic<u64> n_evictions;
+};
+
 /// @brief crypto wrapper object
 class crypto {
 public:
+    using executor = std::function<void(std::function<void()>)>;
+
     crypto();
 
     // public access to pub key
     std::string pub_key();
+    key_scheme scheme();
 
     // generate keypair
-    void generate_keypair();
+    void generate_keypair(key_scheme = static_cast<key_scheme>(dht::constants::key_scheme));
 
-    // import
+    // import (RSA)
     void import_keypair(keypair);
     void import_file(std::string, std::string);
 
-    // export
+    // export (RSA)
     void export_keypair(keypair&);
     void export_file(std::string, std::string);
 
@@ -40,28 +171,78 @@ public:
     std::string sign(std::string);
 
     // verify
-    bool verify(RSA::PublicKey, std::string, std::string);
+    bool verify(const public_key&, std::string, std::string);
     bool verify(std::string, std::string);
     bool verify(dht::hash_t, std::string, std::string);
 
     // keystore
     void ks_put(dht::hash_t, std::string);
-    boost::optional<RSA::PublicKey> ks_get(dht::hash_t);
+    std::shared_ptr<const public_key> ks_get(dht::hash_t);
     void ks_del(dht::hash_t);
     bool ks_has(dht::hash_t);
+    std::size_t ks_open(std::string);
 
     // validate
     bool validate(dht::kv);
+
+    // same as above but run on the crypto pool, completions go through `completions`
+    void async_sign(std::string, std::function<void(std::string)>);
+    void async_verify(dht::hash_t, std::string, std::string, std::function<void(bool)>);
+    void async_validate(dht::kv, std::function<void(bool)>);
+
+    // sessions: X25519 agreement during identify, then HMAC-SHA256 in place of signatures
+    struct ephemeral {
+        SecByteBlock secret;
+        std::string pub;
+    };
+
+    ephemeral session_begin();
+    bool session_put(std::string, const ephemeral&, const std::string&);
+    bool session_has(std::string);
+    void session_del(std::string);
+    std::string session_mac(std::string, const std::string&);
+    bool session_verify(std::string, const std::string&, const std::string&);
+
+    // where async completions run. inline on the crypto pool by default
+    executor completions = [](std::function<void()> f) { f(); };
+
+    verify_cache verified;
+    keystore ks;
     
 private:
-    keypair key_pair;
+    std::unique_ptr<private_key> key;
+    std::shared_ptr<const public_key> own_key;
+
+    // only used for key generation, signing uses per-thread pools
+    std::mutex rng_mutex;
     AutoSeededRandomPool rng;
 
-    std::mutex ks_mutex;
-    std::unordered_map<dht::hash_t, RSA::PublicKey> ks;
+    struct session {
+        std::string name;
+        std::array<byte, SHA256::DIGESTSIZE> key;
+        steady_clock::time_point expires;
+    };
+
+    // front is most recently used, a full table drops the back
+    std::mutex sessions_mutex;
+    std::list<session> session_lru;
+    std::unordered_map<std::string, std::list<session>::iterator> sessions;
+
+    bool session_key(const std::string&, std::array<byte, SHA256::DIGESTSIZE>&);
+
+    void submit(std::function<void()>);
+    void drain();
+
+    // jobs are queued and each worker takes up to crypto_batch at a time
+    std::mutex jobs_mutex;
+    std::deque<std::function<void()>> jobs;
+    int drainers;
+
+    // declared last so workers stop before anything they use goes away
+    boost::asio::thread_pool pool;
 };
 
 }
 }
 
-#endif
\ No newline at end of file
+#endif
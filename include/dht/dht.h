@@ -50,22 +50,29 @@ public:
 
     basic_callback basic_nothing = [](net_contact) { };
 
-    node(bool, u16);
+    node(bool, u16, std::size_t = constants::receive_threads);
     ~node();
 
     hash_t get_id() const;
+    boost::optional<rtt_estimator> rtt(hash_t);
+    u64 identify_coalesced() const;
     
     void run();
     void run(std::string, std::string);
     void generate_keypair();
     void export_keypair(std::string, std::string);
+    void open_keystore(std::string);
 
+    // these block on lookups. call them from your own thread or join's callbacks,
+    // resolve's callbacks run on the continuation pool and must not block
     void put(std::string, std::string);
     void get(std::string, value_callback);
     void provide(std::string, net_peer);
     void get_providers(std::string, contacts_callback);
     void join(net_addr, basic_callback, basic_callback);
     void resolve(hash_t, basic_callback, basic_callback);
+
+    bool flat_table; // routing table backend, read when the node starts running
     
 private:
     using fv_value = boost::variant<boost::blank, kv, std::list<net_contact>>;
@@ -74,6 +81,7 @@ private:
     using identify_callback = std::function<void(net_peer, std::string)>;
     using addresses_callback = std::function<void(net_contact, std::list<net_peer>)>;
     using fut_t = std::tuple<net_contact, fv_value>;
+    using identify_waiter = std::pair<identify_callback, basic_callback>;
 
     struct djc {
         std::mutex mutex;
@@ -85,7 +93,9 @@ private:
     void _run();
 
     std::list<node::fv_value> disjoint_lookup_value(hash_t target_id, int Q) {
-        std::deque<routing_table_entry> initial = table->find_alpha(target_id);
+        // alpha seeds for every path
+        std::vector<net_contact> nearest = table->closest(target_id, proto::alpha * proto::disjoint_paths);
+        std::deque<net_contact> initial(nearest.begin(), nearest.end());
         std::shared_ptr<djc> claimed = std::make_shared<djc>();
         std::list<fv_value> paths;
         std::list<std::future<fv_value>> tasks;
@@ -121,10 +131,10 @@ private:
         return paths;
     }
 
-    void refresh(tree*);
+    void refresh(bucket_range);
     void republish(kv);
 
-    std::future<net_peer> _verify_node(net_peer);
+    void _verify_node(net_peer, std::function<void(net_peer)>);
     std::future<fut_t> _lookup(bool, net_contact, hash_t);
     net_contact resolve_peer_in_table(net_peer);
     std::list<net_contact> lookup_nodes(std::deque<net_contact>, hash_t);
@@ -134,7 +144,14 @@ private:
     void ping(net_contact, basic_callback, basic_callback);
     void iter_store(int, std::string, std::string);
     std::list<net_contact> iter_find_node(hash_t);
-    void identify(net_contact, identify_callback, basic_callback);
+    void identify(net_peer, identify_callback, basic_callback, bool = true);
+    std::vector<identify_waiter> identified(const std::string&);
+
+    // sessions
+    std::string session_to(hash_t);
+    std::string session_from(net_peer);
+    void sign_bucket(net_peer, bool, bool, std::vector<proto::peer_object>, std::function<void(proto::find_node_resp_data)>);
+    void verify_bucket(hash_t, bool, const proto::find_node_resp_data&, std::function<void(bool)>);
     void get_addresses(net_contact, hash_t, addresses_callback, basic_callback);
     void store(bool, net_contact, kv, basic_callback, basic_callback);
     void find_node(net_contact, hash_t, bucket_callback, basic_callback);
@@ -164,8 +181,14 @@ private:
 
     std::random_device rd;
     hash_reng_t reng;
+    std::mutex treng_mutex;
     token_reng_t treng;
 
+    // identify handshakes in flight, by peer id and address
+    std::mutex idf_mutex;
+    std::unordered_map<std::string, std::vector<identify_waiter>> identifying;
+    std::atomic<u64> n_coalesced;
+
     std::thread refresh_thread;
     std::thread republish_thread;
 
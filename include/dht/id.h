@@ -0,0 +1,190 @@
+#ifndef _ID_H
+#define _ID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace lotus {
+namespace dht {
+
+/// @brief fixed width 256-bit node ID. held as four 64-bit words, most significant first,
+/// so bit 0 is the most significant bit and ordering is lexicographic over the words.
+/// heap copies are only 32-byte aligned before C++17 with -faligned-new (see CMakeLists.txt),
+/// so the explicit vector loads are unaligned in case it's built without
+struct alignas(32) node_id {
+    static const int bits = 256;
+    static const int bytes = 32;
+    static const int words = 4;
+
+    std::uint64_t w[words];
+
+    node_id() : w{ 0, 0, 0, 0 } { }
+
+    /// @brief from 32 big endian bytes
+    static node_id from_bytes(const unsigned char* b) {
+        node_id r;
+
+        for(int i = 0; i < words; i++) {
+            std::uint64_t v;
+            std::memcpy(&v, b + i * 8, 8);
+            r.w[i] = be(v);
+        }
+
+        return r;
+    }
+
+    /// @brief to 32 big endian bytes
+    void to_bytes(unsigned char* b) const {
+        for(int i = 0; i < words; i++) {
+            std::uint64_t v = be(w[i]);
+            std::memcpy(b + i * 8, &v, 8);
+        }
+    }
+
+    /// @brief the `n` most significant bits set
+    static node_id prefix_mask(int n) {
+        node_id r;
+
+        for(int i = 0; i < words; i++, n -= 64) {
+            if(n >= 64) r.w[i] = ~std::uint64_t(0);
+            else if(n > 0) r.w[i] = ~std::uint64_t(0) << (64 - n);
+        }
+
+        return r;
+    }
+
+    /// @brief test bit `i`, counting from the most significant
+    bool bit(int i) const {
+        return (w[i >> 6] >> (63 - (i & 63))) & 1;
+    }
+
+    node_id& set(int i) {
+        w[i >> 6] |= std::uint64_t(1) << (63 - (i & 63));
+        return *this;
+    }
+
+    /// @brief number of leading zero bits, 256 for zero. for a ^ b it is the length of the common prefix
+    int clz() const {
+#if defined(__AVX2__)
+        __m256i v = _mm256_loadu_si256((const __m256i*)w);
+        unsigned nz = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi64(v, _mm256_setzero_si256()));
+        if(nz == 0) return bits;
+
+        int i = __builtin_ctz(nz) >> 3;
+        return i * 64 + __builtin_clzll(w[i]);
+#else
+        for(int i = 0; i < words; i++)
+            if(w[i]) return i * 64 + __builtin_clzll(w[i]);
+
+        return bits;
+#endif
+    }
+
+    bool zero() const { return clz() == bits; }
+
+    /// @brief <0, 0 or >0 as a is less than, equal to or greater than b
+    static int compare(const node_id& a, const node_id& b) {
+        unsigned diff;
+
+#if defined(__AVX2__)
+        __m256i x = _mm256_loadu_si256((const __m256i*)a.w);
+        __m256i y = _mm256_loadu_si256((const __m256i*)b.w);
+        diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+#elif defined(__SSE2__)
+        const __m128i* x = (const __m128i*)a.w;
+        const __m128i* y = (const __m128i*)b.w;
+        unsigned lo = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(x), _mm_loadu_si128(y)));
+        unsigned hi = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(x + 1), _mm_loadu_si128(y + 1)));
+        diff = ~(lo | (hi << 16));
+#else
+        diff = 0;
+        for(int i = 0; i < words; i++)
+            if(a.w[i] != b.w[i]) diff |= 0xffu << (i * 8);
+#endif
+
+        if(diff == 0) return 0;
+
+        // first differing byte in memory lies in the most significant differing word
+        int i = __builtin_ctz(diff) >> 3;
+        return a.w[i] < b.w[i] ? -1 : 1;
+    }
+
+    /// @brief true if a is closer to target than b by XOR distance
+    static bool closer(const node_id& a, const node_id& b, const node_id& target) {
+        return compare(a ^ target, b ^ target) < 0;
+    }
+
+    friend node_id operator^(const node_id& a, const node_id& b) {
+        node_id r;
+#if defined(__AVX2__)
+        _mm256_storeu_si256((__m256i*)r.w,
+            _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)a.w), _mm256_loadu_si256((const __m256i*)b.w)));
+#elif defined(__SSE2__)
+        const __m128i* x = (const __m128i*)a.w;
+        const __m128i* y = (const __m128i*)b.w;
+        _mm_storeu_si128((__m128i*)r.w, _mm_xor_si128(_mm_loadu_si128(x), _mm_loadu_si128(y)));
+        _mm_storeu_si128((__m128i*)r.w + 1, _mm_xor_si128(_mm_loadu_si128(x + 1), _mm_loadu_si128(y + 1)));
+#else
+        for(int i = 0; i < words; i++) r.w[i] = a.w[i] ^ b.w[i];
+#endif
+        return r;
+    }
+
+    friend node_id operator&(const node_id& a, const node_id& b) {
+        node_id r;
+        for(int i = 0; i < words; i++) r.w[i] = a.w[i] & b.w[i];
+        return r;
+    }
+
+    friend node_id operator|(const node_id& a, const node_id& b) {
+        node_id r;
+        for(int i = 0; i < words; i++) r.w[i] = a.w[i] | b.w[i];
+        return r;
+    }
+
+    friend node_id operator~(const node_id& a) {
+        node_id r;
+        for(int i = 0; i < words; i++) r.w[i] = ~a.w[i];
+        return r;
+    }
+
+    friend bool operator==(const node_id& a, const node_id& b) { return compare(a, b) == 0; }
+    friend bool operator!=(const node_id& a, const node_id& b) { return compare(a, b) != 0; }
+    friend bool operator<(const node_id& a, const node_id& b) { return compare(a, b) < 0; }
+    friend bool operator>(const node_id& a, const node_id& b) { return compare(a, b) > 0; }
+    friend bool operator<=(const node_id& a, const node_id& b) { return compare(a, b) <= 0; }
+    friend bool operator>=(const node_id& a, const node_id& b) { return compare(a, b) >= 0; }
+
+private:
+    static std::uint64_t be(std::uint64_t v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return __builtin_bswap64(v);
+#else
+        return v;
+#endif
+    }
+};
+
+}
+}
+
+namespace std {
+
+// IDs are hashes already, any word will do
+template <> struct hash<lotus::dht::node_id> {
+    std::size_t operator()(const lotus::dht::node_id& id) const {
+        return static_cast<std::size_t>(id.w[3]);
+    }
+};
+
+}
+
+#endif
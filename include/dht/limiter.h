@@ -0,0 +1,72 @@
+#ifndef _LIMITER_H
+#define _LIMITER_H
+
+#include "util.hpp"
+
+namespace lotus {
+namespace dht {
+
+/// @brief refills at `rate` tokens per second up to `burst`
+struct token_bucket {
+    double tokens;
+    steady_clock::time_point last;
+
+    token_bucket(double burst) : tokens(burst), last(steady_clock::now()) { }
+
+    bool take(double rate, double burst, steady_clock::time_point now) {
+        tokens = std::min(burst, tokens + rate * duration_cast<duration<double>>(now - last).count());
+        last = now;
+
+        if(tokens < 1.0)
+            return false;
+
+        tokens -= 1.0;
+        return true;
+    }
+
+    // hand back a token that was taken but not used
+    void refund(double burst) {
+        tokens = std::min(burst, tokens + 1.0);
+    }
+};
+
+/// @brief per-peer and global token buckets. a message is admitted only
+/// if both the peer's bucket and the global bucket have a token
+class rate_limiter {
+public:
+    rate_limiter(double, double, double, double);
+
+    bool allow(const std::string&);
+    void configure(double, double, double, double);
+
+    u64 admitted() const { return n_admitted; }
+    u64 dropped() const { return n_dropped; }
+    std::size_t tracked();
+
+private:
+    struct shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, token_bucket> peers;
+    };
+
+    shard& shard_for(const std::string& k) { return shards[std::hash<std::string>()(k) % shards.size()]; }
+    void sweep(shard&, steady_clock::time_point);
+
+    std::atomic<double> peer_rate;
+    std::atomic<double> peer_burst;
+    std::atomic<double> global_rate;
+    std::atomic<double> global_burst;
+
+    std::mutex global_mutex;
+    token_bucket global;
+
+    std::array<shard, proto::queue_shards> shards;
+
+    std::atomic<u64> n_admitted;
+    std::atomic<u64> n_dropped;
+};
+
+}
+}
+
+#endif
@@ -5,76 +5,145 @@
 #include "routing.h"
 #include "proto.h"
 #include "upnp.h"
+#include "limiter.h"
 
 namespace lotus {
 namespace dht {
 
+/// @brief pending RPCs. timeouts are steady_timers on the network's io_context,
+/// callbacks are run on a small fixed pool so they never block the receive loop
 class msg_queue {
 public:
-    using q_callback = std::function<void(net_peer, std::string)>;
+    using q_callback = std::function<void(net_peer, proto::response_data)>;
     using f_callback = std::function<void(net_peer)>;
 
-    q_callback q_nothing = [](net_peer, std::string) { };
+    q_callback q_nothing = [](net_peer, proto::response_data) { };
     f_callback f_nothing = [](net_peer) { };
 
-    void await(net_peer, u64, q_callback, f_callback);
-    void satisfy(net_peer, u64, std::string);
+    // called with the round trip time of every satisfied RPC
+    std::function<void(net_peer, milliseconds)> on_rtt = [](net_peer, milliseconds) { };
+
+    msg_queue(boost::asio::io_context&);
+    ~msg_queue();
+
+    void await(net_peer, u64, q_callback, f_callback, milliseconds = seconds(proto::net_timeout));
+    void satisfy(net_peer, u64, proto::response_data);
+    void cancel(net_addr, u64);
+    void reject(net_peer, f_callback);
+    void post(std::function<void()>);
     bool pending(net_peer, u64);
 
+    // number of RPCs awaiting a response
+    std::size_t in_flight() const { return count; }
+
 private:
     struct item {
         net_peer req;
         u64 msg_id;
-        std::promise<std::string> promise;
-        bool satisfied;
-        item(net_peer r, u64 m, bool s) : req(r), msg_id(m), satisfied(s) { }
+        q_callback ok;
+        f_callback bad;
+        boost::asio::steady_timer timer;
+        steady_clock::time_point sent;
+        std::atomic_bool satisfied; // set under the shard lock, read without it when arming
+        item(net_peer r, u64 m, q_callback o, f_callback b, boost::asio::io_context& ioc) : 
+            req(r), msg_id(m), ok(o), bad(b), timer(ioc), sent(steady_clock::now()), satisfied(false) { }
     };
 
-    void wait(std::list<item>::iterator, q_callback, f_callback);
+    // responses are matched on (message ID, address)
+    struct key {
+        u64 msg_id;
+        net_addr addr;
+        bool operator==(const key& k) const { return msg_id == k.msg_id && addr == k.addr; }
+    };
 
-    std::mutex mutex;
-    std::list<item> items;
+    struct key_hash {
+        std::size_t operator()(const key& k) const {
+            std::size_t h = std::hash<std::string>()(k.addr.addr) ^ (std::size_t(k.addr.port) << 16);
+            return std::hash<u64>()(k.msg_id) ^ (h + 0x9e3779b9 + (h << 6) + (h >> 2));
+        }
+    };
+
+    struct shard {
+        std::mutex mutex;
+        std::unordered_map<key, std::shared_ptr<item>, key_hash> items;
+    };
+
+    shard& shard_for(const key& k) { return shards[key_hash()(k) % proto::queue_shards]; }
+
+    void expire(std::shared_ptr<item>);
+
+    boost::asio::io_context& ioc;
+    boost::asio::thread_pool workers;
+
+    std::array<shard, proto::queue_shards> shards;
+    std::atomic<std::size_t> count;
 };
 
 class node;
 
 /// @brief interface for networking
 class network {
+    // declared first so they outlive the queue's timers and any message still in flight
+    boost::asio::io_context ioc;
+    slab_pool slabs;
+    send_pool send_buffers;
+
 public:
     using h_callback = std::function<void(net_peer, proto::message)>;
 
-    network(bool, u16, h_callback);
+    network(bool, u16, h_callback, std::size_t = constants::receive_threads);
     ~network();
 
     void run();
-    void recv();
+
+    // run something on the continuation pool. it must not wait on other continuations
+    void post(std::function<void()> f) { queue.post(std::move(f)); }
+
+    // run something that blocks on RPCs (iterative lookups) on its own thread, the pool is too small for it
+    void spawn(std::function<void()> f) { std::thread(std::move(f)).detach(); }
 
     // send to individual address
     template <typename T>
-    void send(bool f, net_addr addr, int m, int a, hash_t i, u64 q, T d, msg_queue::q_callback ok, msg_queue::f_callback bad) {
-        msgpack::sbuffer sb = prepare_message(m, a, i, q, d);
+    void send(bool f, net_addr addr, int m, int a, hash_t i, u64 q, T d, msg_queue::q_callback ok, msg_queue::f_callback bad, 
+        milliseconds timeout = seconds(proto::net_timeout)) {
+        // responses are never held back, only new RPCs
+        if(f && !outbound.allow(addr.addr)) {
+            queue.reject(net_peer{ hash_t(), addr }, bad);
+            return;
+        }
+
+        send_ref sb = prepare_message(addr, m, a, i, q, d);
 
         if(f) {
-            queue.await(net_peer{ 0, addr }, q, ok, bad);
+            queue.await(net_peer{ hash_t(), addr }, q, ok, bad, timeout);
         }
 
-        socket.async_send_to(
-            boost::asio::buffer(sb.data(), sb.size()), 
-            addr.udp_endpoint(), b_nothing);
+        transmit(std::move(sb), addr.udp_endpoint());
     }
 
     // send with alternate addresses
     template <typename T>
-    void send(bool f, std::vector<net_addr> addresses, int m, int a, hash_t i, u64 q, T d, msg_queue::q_callback ok, msg_queue::f_callback bad) {
-        msgpack::sbuffer sb = prepare_message(m, a, i, q, d);
-
+    void send(bool f, std::vector<net_addr> addresses, int m, int a, hash_t i, u64 q, T d, msg_queue::q_callback ok, msg_queue::f_callback bad, 
+        milliseconds timeout = seconds(proto::net_timeout)) {
         if(addresses.empty())
             return;
 
+        if(f && race && addresses.size() > 1) {
+            send_race(addresses, m, a, i, q, d, ok, bad, timeout);
+            return;
+        }
+
+        if(f && !outbound.allow(addresses.begin()->addr)) {
+            queue.reject(net_peer{ hash_t(), *addresses.begin() }, bad);
+            return;
+        }
+
+        send_ref sb = prepare_message(*addresses.begin(), m, a, i, q, d);
+
         // await a response, if none, try next address
         if(f) {
-            queue.await(net_peer{ 0, *addresses.begin() }, q, ok, 
-                [this, ad = addresses, f, m, a, i, q, d, ok, bad](net_peer p) mutable {
+            queue.await(net_peer{ hash_t(), *addresses.begin() }, q, ok, 
+                [this, ad = addresses, f, m, a, i, q, d, ok, bad, timeout](net_peer p) mutable {
                     if(ad.empty())
                         bad(p);
                     else {
@@ -85,24 +154,85 @@ public:
                         }
 
                         spdlog::debug("network: message expired. trying new address {}", ad.begin()->to_string());
-                        send(f, ad, m, a, i, q, d, ok, bad);
+                        send(f, ad, m, a, i, q, d, ok, bad, timeout);
                     }
-                });
+                }, timeout);
         }
 
         // send
-        socket.async_send_to(
-            boost::asio::buffer(sb.data(), sb.size()), 
-            addresses.begin()->udp_endpoint(), b_nothing);
+        transmit(std::move(sb), addresses.begin()->udp_endpoint());
+    }
+
+    // happy eyeballs: query the first (best) address right away and each following one
+    // proto::race_stagger later unless someone has answered by then. first response wins
+    template <typename T>
+    void send_race(std::vector<net_addr> addresses, int m, int a, hash_t i, u64 q, T d, msg_queue::q_callback ok, msg_queue::f_callback bad, 
+        milliseconds timeout) {
+        struct state {
+            std::atomic_bool done;
+            std::atomic<std::size_t> remaining;
+        };
+
+        std::shared_ptr<state> st = std::make_shared<state>();
+        st->done = false;
+        st->remaining = addresses.size();
+
+        for(std::size_t n = 0; n < addresses.size(); n++) {
+            net_addr addr = addresses[n];
+
+            auto attempt = [=]() {
+                send(true, addr, m, a, i, q, d,
+                    [=](net_peer p, proto::response_data r) {
+                        if(st->done.exchange(true))
+                            return;
+
+                        // stop waiting on the others
+                        for(const auto& o : addresses)
+                            if(!(o == addr)) queue.cancel(o, q);
+
+                        ok(std::move(p), std::move(r));
+                    },
+                    [=](net_peer p) {
+                        if(--st->remaining == 0 && !st->done)
+                            bad(std::move(p));
+                    }, timeout);
+            };
+
+            if(n == 0) {
+                attempt();
+                continue;
+            }
+
+            std::shared_ptr<boost::asio::steady_timer> t = 
+                std::make_shared<boost::asio::steady_timer>(ioc, n * milliseconds(proto::race_stagger));
+
+            t->async_wait([t, st, attempt, addr](boost::system::error_code ec) {
+                if(ec || st->done)
+                    return;
+
+                spdlog::debug("network: no answer yet, racing address {}", addr.to_string());
+                attempt();
+            });
+        }
     }
 
     using b_callback = std::function<void(boost::system::error_code, std::size_t)>;
     b_callback b_nothing = [](boost::system::error_code, std::size_t) { };
 
     msg_queue queue;
+
+    // admission control. inbound covers queries only so responses to our own RPCs always get through
+    rate_limiter inbound;
+    rate_limiter outbound;
+
     u16 port;
     bool local;
+    bool batch; // recvmmsg/sendmmsg, linux only
+    bool race; // race a contact's addresses instead of trying them one by one
     
+    // newest schema version `addr` has spoken to us, 0 if it hasn't yet
+    int schema(const net_addr&);
+
     std::string get_ip_address() {
         return local ? 
             upnp_.get_local_ip_address() : 
@@ -110,32 +240,89 @@ public:
     }
 
 private:
+    // packs the same map as proto::message, straight into a pooled buffer
+    // without building an intermediate msgpack::object for `d`
     template <typename T>
-    msgpack::sbuffer prepare_message(int m, int a, hash_t i, u64 q, T d) {
-        msgpack::zone z;
-        proto::message msg;
-        msg.s = proto::schema_version; // s: schema
-        msg.m = m; // m: message type
-        msg.a = a; // a: action
-        msg.i = dec(i); // i: serialized ID
-        msg.q = q; // q: message ID
-        msg.d = msgpack::object(d, z); // d: action-specific data
-        
-        msgpack::sbuffer sb;
-        msgpack::pack(sb, msg);
-
-        return sb;
+    send_ref prepare_message(const net_addr& to, int m, int a, hash_t i, u64 q, const T& d) {
+        send_ref buf = send_buffers.acquire();
+        msgpack::packer<msgpack::sbuffer> pk(buf->sb);
+        proto::binary_ids ids(schema(to) >= proto::binary_id_schema);
+
+        auto key = [&](const char* k) { pk.pack_str(1); pk.pack_str_body(k, 1); };
+
+        pk.pack_map(6);
+        key("s"); pk.pack(proto::schema_version); // s: schema
+        key("m"); pk.pack(m); // m: message type
+        key("a"); pk.pack(a); // a: action
+        key("i"); pk.pack(i); // i: serialized ID
+        key("q"); pk.pack(q); // q: message ID
+        key("d"); pk.pack(d); // d: action-specific data
+
+        return buf;
     }
 
-    void handle(std::string, udp::endpoint);
+    /// @brief one receiving socket bound to our port, with its own thread
+    struct lane {
+        boost::asio::io_context ioc;
+        udp::socket socket;
+        udp::endpoint endpoint;
+        std::thread thread;
+
+#ifdef __linux__
+        // recvmmsg state, one slab per datagram
+        std::vector<slab_ref> rx;
+        std::vector<mmsghdr> rx_hdrs;
+        std::vector<iovec> rx_iov;
+        std::vector<sockaddr_storage> rx_addrs;
+
+        // datagrams waiting for the next sendmmsg flush
+        std::mutex tx_mutex;
+        std::vector<std::pair<send_ref, udp::endpoint>> tx;
+#endif
+
+        lane(u16, bool, slab_pool&);
+    };
+
+    // newest schema version each address has spoken to us, decides how IDs are packed for it
+    using schema_key = std::pair<std::string, u16>;
+
+    struct schema_hash {
+        std::size_t operator()(const schema_key& k) const {
+            return std::hash<std::string>()(k.first) ^ (std::size_t(k.second) << 16);
+        }
+    };
+
+    struct schema_shard {
+        std::mutex mutex;
+        std::unordered_map<schema_key, int, schema_hash> peers;
+    };
+
+    void saw_schema(const net_addr&, int);
+
+    std::array<schema_shard, proto::queue_shards> schemas;
+
+    void recv(lane&);
+    void handle(slab_ref, udp::endpoint);
+    void transmit(send_ref, udp::endpoint);
+
+#ifdef __linux__
+    void recv_batch(lane&);
+    void flush(lane&);
+#endif
 
     h_callback message_handler;
 
-    boost::asio::io_context ioc;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
     std::thread ioc_thread;
     std::thread release_thread;
-    udp::socket socket;
-    udp::endpoint endpoint;
+
+    // wakes the upnp re-lease loop early when we shut down
+    std::mutex release_mutex;
+    std::condition_variable release_cv;
+    bool stopping;
+
+    std::vector<std::unique_ptr<lane>> lanes;
+    std::atomic<std::size_t> next_lane;
 
     upnp upnp_;
 };
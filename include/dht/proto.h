@@ -2,6 +2,7 @@
 #define _PROTO_H
 
 #include "util.hpp"
+#include "buffer.h"
 
 namespace lotus {
 namespace dht {
@@ -20,7 +21,31 @@ struct peer_record {
 
 namespace proto { // protocol
 
-const int schema_version = 0;
+// 0: RSA identities only
+// 1: identify may carry Ed25519 public keys
+// 2: identify may agree on a session key, bucket responses may carry a MAC instead of a signature
+// 3: IDs are raw 32-byte binary instead of base58 strings
+// 4: store acks carry a CRC-32C over the whole value instead of a CRC-32 up to its first NUL
+const int schema_version = 4;
+const int ed25519_schema = 1;
+const int binary_id_schema = 3;
+const int crc32c_schema = 4;
+
+// IDs are packed as raw bytes while one of these is alive on the thread, base58 otherwise.
+// older peers only read base58, so the sender picks per destination (see network::prepare_message).
+// buckets are signed in whichever encoding they're sent in, a stored value's sig_blob always in base58
+struct binary_ids {
+    explicit binary_ids(bool on) : prev(enabled()) { enabled() = on; }
+    ~binary_ids() { enabled() = prev; }
+
+    static bool& enabled() {
+        thread_local bool on = false;
+        return on;
+    }
+
+private:
+    bool prev;
+};
 
 enum actions {
     ping = 0,
@@ -50,12 +75,12 @@ struct peer_object {
     std::string t;
     std::string a;
     int p;
-    std::string i;
+    hash_t i;
     MSGPACK_DEFINE_MAP(t, a, p, i);
     peer_object() { }
-    peer_object(std::string t_, std::string a_, int p_, std::string i_) : t(t_), a(a_), p(p_), i(i_) { }
-    peer_object(net_peer p_) : t(p_.addr.transport()), a(p_.addr.addr), p(p_.addr.port), i(dec(p_.id)) { }
-    net_peer to_peer() const { return net_peer{ enc(i), net_addr(t, a, p) }; }
+    peer_object(std::string t_, std::string a_, int p_, hash_t i_) : t(t_), a(a_), p(p_), i(i_) { }
+    peer_object(net_peer p_) : t(p_.addr.transport()), a(p_.addr.addr), p(p_.addr.port), i(p_.id) { }
+    net_peer to_peer() const { return net_peer{ i, net_addr(t, a, p) }; }
 };
 
 struct stored_data {
@@ -68,14 +93,15 @@ struct stored_data {
 };
 
 struct find_query_data {
-    std::string t;
-    MSGPACK_DEFINE_MAP(t);
+    hash_t t;
+    bool m = false; // sender holds a session key with the recipient
+    MSGPACK_DEFINE_MAP(t, m);
 };
 
 // store
 
 struct store_query_data {
-    std::string k;
+    hash_t k;
     int d;
     std::string v;
     boost::optional<peer_object> o;
@@ -95,7 +121,8 @@ struct store_resp_data {
 struct find_node_resp_data {
     std::vector<peer_object> b;
     std::string s;
-    MSGPACK_DEFINE_MAP(b, s);
+    boost::optional<std::string> m;
+    MSGPACK_DEFINE_MAP(b, s, m);
 };
 
 // find_value
@@ -110,13 +137,15 @@ struct find_value_resp_data {
 
 struct identify_query_data {
     std::string s;
-    MSGPACK_DEFINE_MAP(s);
+    boost::optional<std::string> e;
+    MSGPACK_DEFINE_MAP(s, e);
 };
 
 struct identify_resp_data {
     std::string k;
     std::string s;
-    MSGPACK_DEFINE_MAP(k, s);
+    boost::optional<std::string> e;
+    MSGPACK_DEFINE_MAP(k, s, e);
 };
 
 // get_addresses
@@ -131,27 +160,39 @@ struct address_object {
 };
 
 struct get_addresses_query_data {
-    std::string i;
+    hash_t i;
     MSGPACK_DEFINE_MAP(i);
 };
 
 struct get_addresses_resp_data {
-    std::string i;
+    hash_t i;
     std::vector<address_object> p;
     MSGPACK_DEFINE_MAP(i, p);
 };
 
+// decoded response payloads, handed from handlers to RPC continuations as-is
+using response_data = boost::variant<
+    boost::blank, // ping
+    store_resp_data,
+    find_node_resp_data,
+    find_value_resp_data,
+    identify_resp_data,
+    get_addresses_resp_data>;
+
 struct message {
     int s;
     int m;
     int a;
-    std::string i;
+    hash_t i;
     u64 q;
     msgpack::object d;
     MSGPACK_DEFINE_MAP(s, m, a, i, q, d);
+
+    // not serialized. `d` points into this slab, keep it alive with the message
+    slab_ref buf;
 };
 
-// sig blob
+// sig blob. keeps base58 IDs, it is what origins sign
 
 struct sig_blob {
     std::string k;
@@ -167,4 +208,48 @@ struct sig_blob {
 }
 }
 
+namespace msgpack {
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
+namespace adaptor {
+
+// IDs are read from either encoding
+template <>
+struct convert<lotus::dht::node_id> {
+    msgpack::object const& operator()(msgpack::object const& o, lotus::dht::node_id& v) const {
+        if(o.type == msgpack::type::BIN && o.via.bin.size == lotus::dht::node_id::bytes)
+            v = lotus::dht::node_id::from_bytes((const unsigned char*)o.via.bin.ptr);
+        else if(o.type == msgpack::type::STR)
+            v = lotus::dht::util::b58decode_h(o.via.str.ptr, o.via.str.size);
+        else
+            throw msgpack::type_error();
+
+        return o;
+    }
+};
+
+template <>
+struct pack<lotus::dht::node_id> {
+    template <typename Stream>
+    msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, lotus::dht::node_id const& v) const {
+        if(lotus::dht::proto::binary_ids::enabled()) {
+            unsigned char b[lotus::dht::node_id::bytes];
+            v.to_bytes(b);
+
+            o.pack_bin(sizeof(b));
+            o.pack_bin_body((const char*)b, sizeof(b));
+        } else {
+            std::string s = lotus::dht::util::b58encode_h(v);
+
+            o.pack_str(s.size());
+            o.pack_str_body(s.data(), s.size());
+        }
+
+        return o;
+    }
+};
+
+}
+}
+}
+
 #endif
\ No newline at end of file
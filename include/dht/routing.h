@@ -10,44 +10,98 @@ namespace dht {
 struct tree;
 class node;
 
+/// @brief where a bucket sits, copied out so callers can act on it without holding the table
+struct bucket_range {
+    hash_t prefix;
+    int cutoff;
+    u64 last_seen;
+};
+
+/// @brief k-buckets keyed by XOR distance from our ID. the backend decides how buckets are laid out
+/// and found (see trie_table and flat_table), everything per-entry is shared
 class routing_table : public std::enable_shared_from_this<routing_table> {
 public:
     routing_table(hash_t, network&);
-    ~routing_table();
+    virtual ~routing_table();
 
-    void init();
+    virtual void init();
+
+    /// @brief every non-empty bucket, under a read lock. `fn` must not lock the table
+    virtual void each(std::function<void(bucket&)>) = 0;
+    virtual void update(net_peer) = 0;
+
+    /// @brief the `n` live contacts closest to a target by XOR distance, closest first
+    virtual std::vector<net_contact> closest(const hash_t&, std::size_t) = 0;
+
+    /// @brief every non-empty bucket's range as of now
+    std::vector<bucket_range> ranges();
+
+    /// @brief swap the bucket an ID falls in for the contacts given that belong there
+    std::size_t replace(const hash_t&, const std::list<net_contact>&);
 
-    void traverse(bool, hash_t, tree**, int&);
-    void dfs(std::function<void(tree*)>);
-    void split(tree*, int);
-    void update(net_peer);
     void stale(net_peer);
+    void responded(net_peer);
     bucket& find_bucket(hash_t);
-    std::deque<routing_table_entry> find_alpha(hash_t);
     boost::optional<routing_table_entry> find(hash_t);
 
+    // round trip times
+    void rtt_sample(net_peer, milliseconds);
+    milliseconds timeout(hash_t);
+    boost::optional<rtt_estimator> rtt(hash_t);
+
     hash_t id;
-    
+
     network& net;
 
     boost::shared_mutex mutex;
 
-    tree* root;
+protected:
+    /// @brief the bucket an ID falls in. callers hold `mutex`
+    virtual bucket& locate(const hash_t&) = 0;
 
-private:
-    void _dfs(std::function<void(tree*)>, tree*);
+    /// @brief an entry and its distance to the target. closest() only copies out the ones it keeps
+    struct candidate {
+        hash_t d;
+        const bucket* b;
+        int i;
+    };
 
+    static std::vector<candidate>& scratch();
+    static void gather(const bucket&, const hash_t&, std::vector<candidate>&);
+    static std::vector<net_contact> pick(std::vector<candidate>&, std::size_t);
+
+private:
     std::shared_ptr<routing_table> strong_ref;
 };
 
+/// @brief XOR-trie of buckets, split along our own ID as they fill up
+class trie_table : public routing_table {
+public:
+    trie_table(hash_t, network&);
+    ~trie_table();
+
+    void init() override;
+
+    void each(std::function<void(bucket&)>) override;
+    void update(net_peer) override;
+    std::vector<net_contact> closest(const hash_t&, std::size_t) override;
+
+    tree* root;
+
+protected:
+    bucket& locate(const hash_t&) override;
+
+private:
+    void traverse(bool, hash_t, tree**, int&);
+    void split(tree*, int);
+    void _dfs(std::function<void(bucket&)>, tree*);
+    void walk(tree*, int, const hash_t&, std::size_t, std::vector<candidate>&);
+};
+
 struct tree {
     tree* parent;
     tree* left;
     tree* right;
-    struct { 
-        hash_t prefix;
-        int cutoff;
-    } prefix;
     bucket data;
     bool leaf;
 
@@ -55,7 +109,28 @@ struct tree {
     ~tree();
 };
 
+/// @brief one bucket per common prefix length with our ID, held in a single array.
+/// an ID's bucket is clz(id ^ our ID), so finding it is O(1) and nothing ever splits
+class flat_table : public routing_table {
+public:
+    flat_table(hash_t, network&);
+
+    void init() override;
+
+    void each(std::function<void(bucket&)>) override;
+    void update(net_peer) override;
+    std::vector<net_contact> closest(const hash_t&, std::size_t) override;
+
+protected:
+    bucket& locate(const hash_t&) override;
+
+private:
+    int index(const hash_t& t) const { return std::min((t ^ id).clz(), hash_t::bits - 1); }
+
+    std::unique_ptr<bucket[]> buckets;
+};
+
 }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -18,26 +18,36 @@
 #include <future>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <cstdlib>
 #include <ctime>
 #include <cstdint>
 #include <cassert>
 #include <tuple>
 #include <deque>
+#include <fstream>
+#include <array>
+#include <unordered_set>
+#include <atomic>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#endif
 
 #undef NDEBUG
 #define BOOST_BIND_NO_PLACEHOLDERS
 
 #include <boost/asio.hpp>
 #include <boost/optional.hpp>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
 #include <boost/variant.hpp>
 #include <boost/thread/shared_mutex.hpp>
 #include <boost/thread/shared_lock_guard.hpp>
 
-#include <boost/multiprecision/cpp_int.hpp>
 #include <boost/random.hpp>
 
 #include "msgpack.hpp"
+#include "id.h"
 #include "spdlog/spdlog.h"
 #include "cryptopp/rsa.h"
 #include "cryptopp/sha.h"
@@ -45,13 +55,15 @@
 #include "cryptopp/osrng.h"
 #include "cryptopp/hex.h"
 #include "cryptopp/files.h"
+#include "cryptopp/xed25519.h"
+#include "cryptopp/hmac.h"
 #include "miniupnpc/miniupnpc.h"
 #include "miniupnpc/upnpcommands.h"
 #include "miniupnpc/upnperrors.h"
 
 #define LOCK(m) std::lock_guard<std::mutex> l(m);
 #define R_LOCK(m) boost::shared_lock<boost::shared_mutex> read_lock(m);
-#define W_LOCK(m) boost::upgrade_lock<boost::shared_mutex> write_lock(m);
+#define W_LOCK(m) boost::unique_lock<boost::shared_mutex> write_lock(m);
 #define TIME_NOW() duration_cast<seconds>(system_clock::now().time_since_epoch()).count()
 
 namespace lotus {
@@ -78,6 +90,12 @@ const int bit_hash_width = 256; // hash width in bits
 const int missed_pings_allowed = 3; // number of missed pings allowed
 const int missed_messages_allowed = 3; // number of missed messages allowed
 const int net_timeout = 10; // number of seconds until timeout
+const int rtt_initial = 3000; // timeout in milliseconds for peers without an RTT sample yet
+const int rtt_floor = 200; // lowest adaptive timeout in milliseconds
+const int rtt_ceiling = net_timeout * 1000; // highest adaptive timeout in milliseconds
+const int race_stagger = 250; // milliseconds between racing each of a contact's addresses
+const int callback_threads = 4; // number of threads running RPC continuations
+const int queue_shards = 16; // number of lock shards in the pending RPC table
 const int repl_cache_size = 3; // number of peers allowed in bucket replacement cache at one time
 const u64 max_data_size = 65535; // max data size in bytes
 const int alpha = 3; // alpha from kademlia paper
@@ -96,22 +114,39 @@ const int table_entry_addr_limit = 10; // max number of addrs allowed for one ta
 namespace constants {
 
 const int upnp_release_interval = 14400; // number of seconds between each upnp port re-leasing
+const int receive_threads = 1; // number of sockets/threads receiving on our port (SO_REUSEPORT when > 1)
+const bool batch_io = true; // use recvmmsg/sendmmsg where available
+const int batch_size = 16; // max number of datagrams per recvmmsg/sendmmsg call
+const bool race_addresses = true; // race a contact's addresses (happy eyeballs) instead of failing over
+const double inbound_peer_rate = 20; // queries per second accepted from one address
+const double inbound_peer_burst = 50; // queries accepted from one address in a burst
+const double inbound_global_rate = 2000; // queries per second accepted in total
+const double inbound_global_burst = 4000; // queries accepted in total in a burst
+const double outbound_peer_rate = 20; // RPCs per second sent to one address
+const double outbound_peer_burst = 50; // RPCs sent to one address in a burst
+const double outbound_global_rate = 1000; // RPCs per second sent in total
+const double outbound_global_burst = 2000; // RPCs sent in total in a burst
+const int limiter_peers = 65536; // max number of addresses a rate limiter keeps track of
+const int schema_peers = 65536; // max number of addresses whose schema version is remembered
+const int key_scheme = 0; // signature scheme for newly generated identities (0: RSA, 1: Ed25519). schema 0 peers can't identify Ed25519 nodes
+const int verify_cache_size = 65536; // number of verified signatures remembered
+const int keystore_size = 16384; // number of peer public keys remembered
+const bool session_macs = true; // agree on session keys during identify and MAC bucket responses
+const int session_size = 4096; // max number of session keys held
+const int session_ttl = 3600; // session key lifetime (seconds)
+const int crypto_threads = 2; // number of threads doing signing and verification
+const int crypto_batch = 32; // max number of crypto jobs a worker takes per wakeup
+const int receive_slabs = 128; // number of pooled receive buffers (max_data_size each)
+const int send_buffers = 64; // number of pooled send buffers
+const bool flat_table = false; // flat array of buckets indexed by common prefix length instead of the XOR-trie
 
 }
 
-typedef boost::multiprecision::number<
-    boost::multiprecision::cpp_int_backend<
-        proto::bit_hash_width, 
-        proto::bit_hash_width, 
-        boost::multiprecision::unsigned_magnitude, 
-        boost::multiprecision::unchecked, 
-        void>, 
-    boost::multiprecision::et_off> hash_t;
+static_assert(node_id::bits == proto::bit_hash_width, "node_id must be bit_hash_width wide");
+
+typedef node_id hash_t;
 
-typedef boost::random::independent_bits_engine<
-    boost::mt19937, 
-    proto::bit_hash_width, 
-    hash_t> hash_reng_t;
+typedef std::mt19937_64 hash_reng_t;
 
 typedef std::independent_bits_engine<
     std::default_random_engine, CHAR_BIT, unsigned char> token_reng_t;
@@ -158,12 +193,46 @@ struct net_addr {
     }
 };
 
+// smoothed round trip time and retransmission timeout, as in TCP (RFC 6298)
+struct rtt_estimator {
+    milliseconds srtt;
+    milliseconds rttvar;
+    milliseconds rto;
+    bool measured;
+
+    rtt_estimator() : srtt(0), rttvar(0), rto(proto::rtt_initial), measured(false) { }
+
+    void sample(milliseconds r) {
+        if(!measured) {
+            srtt = r;
+            rttvar = r / 2;
+            measured = true;
+        } else {
+            milliseconds err = srtt > r ? srtt - r : r - srtt;
+            rttvar = (3 * rttvar + err) / 4;
+            srtt = (7 * srtt + r) / 8;
+        }
+
+        rto = clamp(srtt + std::max(milliseconds(1), 4 * rttvar));
+    }
+
+    // no response, back off until the next sample
+    void backoff() {
+        rto = clamp(rto * 2);
+    }
+
+    static milliseconds clamp(milliseconds t) {
+        return std::min(std::max(t, milliseconds(proto::rtt_floor)), milliseconds(proto::rtt_ceiling));
+    }
+};
+
 // for outgoing messages or internal work
 struct routing_table_entry {
     typedef std::pair<net_addr, int> mi_addr;
 
     hash_t id;
     std::vector<mi_addr> addresses;
+    rtt_estimator rtt;
 
     routing_table_entry(hash_t i, net_addr a) :
         id(i), addresses{ { a, 0 } } { }
@@ -178,18 +247,25 @@ struct net_peer {
     net_peer(hash_t id_, net_addr addr_) : id(id_), addr(addr_) { }
     bool operator==(const net_peer& rhs) { return id == rhs.id && addr == rhs.addr; }
     bool operator!=(const net_peer& rhs) { return !(*this == rhs); }
-} static empty_net_peer{ 0, net_addr("", "", 0) };
+} static empty_net_peer{ hash_t(), net_addr("", "", 0) };
 
 // for when we've resolved a net_peer from routing_table
 struct net_contact {
     hash_t id;
     std::vector<net_addr> addresses;
 
-    net_contact() : id(0), addresses() { }
+    net_contact() : id(), addresses() { }
     net_contact(hash_t id_, std::vector<net_addr> addrs) : id(id_), addresses(addrs) { }
     net_contact(const net_peer& p) : id(p.id), addresses{ p.addr } { }
+    // best (fewest missed messages) addresses first
     net_contact(const routing_table_entry& rte) : id(rte.id) {
-        for(auto a : rte.addresses)
+        std::vector<routing_table_entry::mi_addr> sorted(rte.addresses);
+        std::stable_sort(sorted.begin(), sorted.end(), 
+            [](const routing_table_entry::mi_addr& a, const routing_table_entry::mi_addr& b) { 
+                return a.second < b.second; 
+            });
+
+        for(const auto& a : sorted)
             addresses.push_back(a.first);
     }
 
@@ -229,7 +305,11 @@ static u64 msg_id() {
 }
 
 static hash_t gen_randomness(hash_reng_t& reng) {
-    return reng();
+    hash_t r;
+    for(auto& w : r.w)
+        w = reng();
+
+    return r;
 }
 
 static std::string gen_token(token_reng_t& reng) {
@@ -240,6 +320,7 @@ static std::string gen_token(token_reng_t& reng) {
 }
 
 // http://www.hackersdelight.org/hdcodetxt/crc.c.txt
+// legacy store checksum, stops at the first NUL. only used for peers older than proto::crc32c_schema
 static unsigned int crc32b(unsigned char *message) {
    int i, j;
    unsigned int byte, crc, mask;
@@ -258,24 +339,50 @@ static unsigned int crc32b(unsigned char *message) {
    return ~crc;
 }
 
-static hash_t hash(std::string s) {
-    std::stringstream ss;
-    ss << "0x"; // hacky but required for hex->int
-
-    CryptoPP::HexEncoder he(new CryptoPP::FileSink(ss));
+/// @brief CRC-32C (Castagnoli) over all `len` bytes, see checksum.cpp.
+/// pass a previous result as `crc` to continue it over more data
+u32 crc32c(const void* data, std::size_t len, u32 crc = 0);
 
-    std::string digest;
-    CryptoPP::SHA256 h;
+// the two implementations crc32c picks between, so each can be checked on its own.
+// crc32c_sse42 is only valid where crc32c_has_sse42()
+u32 crc32c_slicing8(const void* data, std::size_t len, u32 crc = 0);
+u32 crc32c_sse42(const void* data, std::size_t len, u32 crc = 0);
+bool crc32c_has_sse42();
 
-    h.Update((const CryptoPP::byte*)s.data(), s.size());
-    digest.resize(h.DigestSize() + 2); // hacky
-    h.Final((CryptoPP::byte*)&digest[2]);
+// SHA-256 straight into an ID, no allocations
+static hash_t hash(const void* data, std::size_t len) {
+    CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
+    CryptoPP::SHA256().CalculateDigest(digest, (const CryptoPP::byte*)data, len);
 
-    (void)CryptoPP::StringSource(digest, true, new CryptoPP::Redirector(he));
+    return hash_t::from_bytes(digest);
+}
 
-    return hash_t(ss.str());
+static hash_t hash(const std::string& s) {
+    return hash(s.data(), s.size());
 }
 
+// same as hash() for values fed in pieces, e.g. while they're being read or received
+class hasher {
+public:
+    hasher& update(const void* data, std::size_t len) {
+        h.Update((const CryptoPP::byte*)data, len);
+        return *this;
+    }
+
+    hasher& update(const std::string& s) { return update(s.data(), s.size()); }
+
+    // also resets the hasher for the next value
+    hash_t final() {
+        CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
+        h.Final(digest);
+
+        return hash_t::from_bytes(digest);
+    }
+
+private:
+    CryptoPP::SHA256 h;
+};
+
 // most of the base58 code is ripped from https://bitcoin.stackexchange.com/a/96359
 // i removed the unnecessary abstractions so we can just get string in string out
 
@@ -353,35 +460,88 @@ static std::string b58decode_s(const std::string& data) {
     return res;
 }
 
-// encode hash into base58 (https://learnmeabitcoin.com/technical/base58)
-static std::string b58encode_h(hash_t h) {
-    std::deque<char> result;
-    while(h > 0) {
-        int remainder = (h % 58).convert_to<int>();
-        result.push_front(b58map[remainder]);
-        h /= 58;
+// base58 of a hash as a number (https://learnmeabitcoin.com/technical/base58), for display.
+// works on 32-bit limbs so each long division peels off five digits (58^5 < 2^32)
+static const u32 b58pow5 = 58 * 58 * 58 * 58 * 58;
+
+// leading zero bytes produce no digits, zero encodes to ""
+static std::string b58encode_h(const hash_t& h) {
+    u32 n[hash_t::words * 2]; // most significant first
+    for(int i = 0; i < hash_t::words; i++) {
+        n[2 * i] = static_cast<u32>(h.w[i] >> 32);
+        n[2 * i + 1] = static_cast<u32>(h.w[i]);
     }
 
-    std::string res(result.begin(), result.end());
-    return res;
+    const int limbs = hash_t::words * 2;
+    int top = 0;
+    while(top < limbs && n[top] == 0)
+        top++;
+
+    char buf[45]; // 256 bits is at most 44 digits
+    int pos = sizeof(buf);
+
+    while(top < limbs) {
+        u64 rem = 0;
+        for(int i = top; i < limbs; i++) {
+            u64 cur = (rem << 32) | n[i];
+            n[i] = static_cast<u32>(cur / b58pow5);
+            rem = cur % b58pow5;
+        }
+
+        while(top < limbs && n[top] == 0)
+            top++;
+
+        // five digits per group, the most significant group without leading zeros
+        for(int k = 0; k < 5 && (top < limbs || rem); k++, rem /= 58)
+            buf[--pos] = b58map[rem % 58];
+    }
+
+    return std::string(buf + pos, buf + sizeof(buf));
 }
 
-// decode base58 into hash (https://learnmeabitcoin.com/technical/base58)
-static hash_t b58decode_h(std::string s) {
-    hash_t result = 0;
-    
-    for(std::size_t i = 0; i != s.size(); i++) {
-        const char* p = std::strchr(b58map, s[i]);
-        if(p == NULL)
-            throw std::runtime_error("invalid base58 character");
+// decode base58 into hash, five digits per multiply. anything past 256 bits is dropped
+static hash_t b58decode_h(const char* s, std::size_t len) {
+    const int limbs = hash_t::words * 2;
+    u32 n[limbs] = { 0 }; // most significant first
+
+    for(std::size_t i = 0; i < len;) {
+        u64 mul = 1, add = 0;
+
+        for(int k = 0; k < 5 && i < len; k++, i++) {
+            u8 v = (s[i] & 0x80) ? 0xff : alphamap[static_cast<u8>(s[i])];
+            if(v == 0xff)
+                throw std::runtime_error("invalid base58 character");
 
-        result = result * 58 + (p - b58map);
+            add = add * 58 + v;
+            mul *= 58;
+        }
+
+        for(int j = limbs - 1; j >= 0; j--) {
+            u64 cur = static_cast<u64>(n[j]) * mul + add;
+            n[j] = static_cast<u32>(cur);
+            add = cur >> 32;
+        }
     }
 
-    return result;
+    hash_t h;
+    for(int i = 0; i < hash_t::words; i++)
+        h.w[i] = (static_cast<u64>(n[2 * i]) << 32) | n[2 * i + 1];
+
+    return h;
+}
+
+static hash_t b58decode_h(const std::string& s) {
+    return b58decode_h(s.data(), s.size());
+}
+
+// raw 32 big endian bytes, for map keys
+static std::string htob(const hash_t& h) {
+    std::string s(hash_t::bytes, '\0');
+    h.to_bytes(reinterpret_cast<u8*>(&s[0]));
+    return s;
 }
 
-static std::string htos(hash_t h) {
+static std::string htos(const hash_t& h) {
     return b58encode_h(h);
 }
 
@@ -389,11 +549,11 @@ static std::string htos(hash_t h) {
 
 // aliases
 
-static hash_t enc(std::string s) {
+static hash_t enc(const std::string& s) {
     return util::b58decode_h(s);
 }
 
-static std::string dec(hash_t h) {
+static std::string dec(const hash_t& h) {
     return util::b58encode_h(h);
 }
 
@@ -5,32 +5,198 @@
 namespace lotus {
 namespace dht {
 
-bucket::bucket(std::shared_ptr<routing_table> rt) : max_size(proto::bucket_size), last_seen(0), table(rt) { };
+bucket::bucket() : last_seen(0), max_size(proto::bucket_size), cutoff(0), count(0) { };
+bucket::bucket(std::shared_ptr<routing_table> rt) : last_seen(0), max_size(proto::bucket_size), cutoff(0), table(rt), count(0) { };
+
+/// storage
+
+int bucket::slot(const hash_t& id) const {
+    for(int s = 0; s < count; s++)
+        if(ids[s] == id)
+            return s;
+
+    return -1;
+}
+
+int bucket::position(int s) const {
+    return static_cast<int>(std::find(order, order + count, s) - order);
+}
+
+int bucket::find(const hash_t& id) const {
+    int s = slot(id);
+    return s < 0 ? -1 : position(s);
+}
+
+int bucket::address(int s, const packed_addr& a) const {
+    for(int i = 0; i < n_addrs[s]; i++)
+        if(addrs[s][i] == a)
+            return i;
+
+    return -1;
+}
+
+/// @brief new entry in the next free slot, most recently seen
+int bucket::add(const hash_t& id, const packed_addr& a) {
+    int s = count;
+
+    ids[s] = id;
+    rtts[s] = rtt_estimator();
+    n_addrs[s] = 1;
+    addrs[s][0] = a;
+    misses[s][0] = 0;
+
+    order[count++] = s;
+    return s;
+}
+
+void bucket::add_address(int s, const packed_addr& a) {
+    if(n_addrs[s] >= addr_limit)
+        return;
+
+    addrs[s][n_addrs[s]] = a;
+    misses[s][n_addrs[s]] = 0;
+    n_addrs[s]++;
+}
+
+/// @brief drop slot `s`, the last slot moves into its place so slots stay packed
+void bucket::erase(int s) {
+    int p = position(s);
+    std::copy(order + p + 1, order + count, order + p);
+
+    int last = --count;
+    if(s == last)
+        return;
+
+    ids[s] = ids[last];
+    rtts[s] = rtts[last];
+    n_addrs[s] = n_addrs[last];
+    std::copy(addrs[last], addrs[last] + n_addrs[last], addrs[s]);
+    std::copy(misses[last], misses[last] + n_addrs[last], misses[s]);
+
+    *std::find(order, order + count, last) = s;
+}
+
+/// @brief move slot `s` to the tail of the LRU order
+void bucket::touch(int s) {
+    int p = position(s);
+    std::copy(order + p + 1, order + count, order + p);
+    order[count - 1] = s;
+}
+
+routing_table_entry bucket::entry(int i) const {
+    int s = order[i];
+
+    routing_table_entry e(ids[s], addrs[s][0].unpack());
+    e.addresses[0].second = misses[s][0];
+
+    for(int a = 1; a < n_addrs[s]; a++)
+        e.addresses.emplace_back(addrs[s][a].unpack(), misses[s][a]);
+
+    e.rtt = rtts[s];
+    return e;
+}
+
+// best (fewest missed messages) addresses first
+net_contact bucket::contact(int i) const {
+    int s = order[i];
+
+    u8 by_misses[addr_limit];
+    for(int a = 0; a < n_addrs[s]; a++)
+        by_misses[a] = a;
+
+    std::stable_sort(by_misses, by_misses + n_addrs[s], 
+        [&](u8 a, u8 b) { return misses[s][a] < misses[s][b]; });
+
+    net_contact c;
+    c.id = ids[s];
+    c.addresses.reserve(n_addrs[s]);
+
+    for(int a = 0; a < n_addrs[s]; a++)
+        c.addresses.push_back(addrs[s][by_misses[a]].unpack());
+
+    return c;
+}
+
+bool bucket::live(int i) const {
+    int s = order[i];
+
+    for(int a = 0; a < n_addrs[s]; a++)
+        if(misses[s][a] < proto::missed_pings_allowed)
+            return true;
+
+    return false;
+}
+
+bool bucket::insert(const routing_table_entry& e) {
+    if(size() >= max_size || slot(e.id) >= 0)
+        return false;
+
+    int s = -1;
+    for(const auto& a : e.addresses) {
+        packed_addr pa;
+        if(!packed_addr::pack(a.first, pa)) {
+            spdlog::debug("routing: {} is not an IP address, dropping it from {}", a.first.to_string(), util::htos(e.id));
+            continue;
+        }
+
+        if(s < 0) {
+            s = add(e.id, pa);
+            rtts[s] = e.rtt;
+        } else {
+            add_address(s, pa);
+        }
+
+        misses[s][n_addrs[s] - 1] = static_cast<u8>(std::min(a.second, 255));
+    }
+
+    return s >= 0;
+}
+
+/// @brief record a response. the answering address is cleared of misses so it's tried first next time
+void bucket::sample(net_peer p, milliseconds r) {
+    int s = slot(p.id);
+    if(s < 0)
+        return;
+
+    rtts[s].sample(r);
+
+    packed_addr pa;
+    int a;
+    if(packed_addr::pack(p.addr, pa) && (a = address(s, pa)) >= 0)
+        misses[s][a] = 0;
+}
+
+/// updates
 
 void bucket::responded(net_peer req) {
     spdlog::debug("routing: responded, updating");
-    auto it = std::find_if(begin(), end(), [&](routing_table_entry e) { return e.id; });
-    if(it == end())
+    int s = slot(req.id);
+    if(s < 0)
         return;
 
-    auto a = std::find_if(it->addresses.begin(), it->addresses.end(), 
-        [&](const routing_table_entry::mi_addr& ad) { return ad.first == req.addr; });
+    packed_addr pa;
+    if(!packed_addr::pack(req.addr, pa)) {
+        spdlog::debug("routing: {} is not an IP address, ignoring response from {}", req.addr.to_string(), util::htos(req.id));
+        return;
+    }
+
+    int a = address(s, pa);
 
-    if(a == it->addresses.end()) {
+    if(a < 0) {
         // new address. ignore if limit is reached
-        if(it->addresses.size() < proto::table_entry_addr_limit) {
-            it->addresses.emplace_back(req.addr, 0);
-            spdlog::debug("routing: new address for existing node {} found: {}, adding.", util::htos(it->id), req.addr.to_string());
+        if(n_addrs[s] < addr_limit) {
+            add_address(s, pa);
+            spdlog::debug("routing: new address for existing node {} found: {}, adding.", util::htos(req.id), req.addr.to_string());
         }
     } else {
-        if(a->second < proto::missed_pings_allowed) {
-            if(a->second-- == 0) a->second = 0;
-            
-            splice(end(), *this, it);
-            spdlog::debug("routing: pending node {} updated", util::htos(it->id));
+        if(misses[s][a] < proto::missed_pings_allowed) {
+            if(misses[s][a] > 0) misses[s][a]--;
+
+            touch(s);
+            spdlog::debug("routing: pending node {} updated", util::htos(req.id));
         } else {
-            erase(it);
-            spdlog::debug("routing: erasing pending node {}", util::htos(it->id));
+            erase(s);
+            spdlog::debug("routing: erasing pending node {}", util::htos(req.id));
         }
     }
 
@@ -38,35 +204,31 @@ void bucket::responded(net_peer req) {
 }
 
 void bucket::stale(net_peer req) {
-    auto it = std::find_if(begin(), end(), 
-        [&](const routing_table_entry& e) { return e.id == req.id; });
-
-    if(it == end())
+    int s = slot(req.id);
+    if(s < 0)
         return; // fail?
 
-    auto itt = std::find_if(it->addresses.begin(), it->addresses.end(), 
-        [&](routing_table_entry::mi_addr ad) { return ad.first == req.addr; });
+    rtts[s].backoff();
+
+    packed_addr pa;
+    int a;
 
-    if(itt != it->addresses.end()) {
+    if(packed_addr::pack(req.addr, pa) && (a = address(s, pa)) >= 0) {
         // make address more stale
         // if too stale, evict address
-        if(itt->second++ > proto::missed_pings_allowed) {
-            spdlog::debug("routing: did not respond, evicting address {} from {}", 
-                req.addr.to_string(), 
+        if(misses[s][a]++ > proto::missed_pings_allowed) {
+            spdlog::debug("routing: did not respond, evicting address {} from {}",
+                req.addr.to_string(),
                 util::htos(req.id));
 
-            // if this is the last address available, see if can remove from bucket
-            if(it->addresses.size() == 1) {
-                // do we have something in the cache? if so, add to bucket instead
-                if(!cache.empty()) {
-                    LOCK(cache_mutex);
-
-                    const net_peer& cit = cache.back();
-                    emplace_back(cit.id, cit.addr);
-                } else {
-                    // nothing left in cache, nothing left in address list, just erase it from bucket
-                    erase(it);
-                }
+            if(n_addrs[s] > 1) {
+                int last = --n_addrs[s];
+                addrs[s][a] = addrs[s][last];
+                misses[s][a] = misses[s][last];
+            } else {
+                // that was its last address, erase it from bucket and refill from the cache
+                erase(s);
+                promote();
             }
         }
     }
@@ -75,77 +237,122 @@ void bucket::stale(net_peer req) {
 }
 
 void bucket::add_new(net_peer req) {
+    packed_addr pa;
+
+    if(!packed_addr::pack(req.addr, pa)) {
+        spdlog::debug("routing: {} is not an IP address, not adding node {}", req.addr.to_string(), util::htos(req.id));
+        return;
+    }
+
     if(size() < max_size) {
-        emplace_back(req.id, req.addr);
+        add(req.id, pa);
         spdlog::debug("routing: new node (id: {}, addr: {}), size: {}", util::htos(req.id), req.addr.to_string(), size());
-    
+
         last_seen = TIME_NOW();
     }
 }
 
-// called when entry is "nearby". 
+// called when entry is "nearby".
 // if exists, move to back
 // if exists but address is new, move to back and add to address list
 void bucket::update_near_entry(net_peer req) {
-    if(empty())
-        return;
-
-    auto rit = std::find_if(begin(), end(), 
-        [&](routing_table_entry e) { return e.id == req.id; });
+    int s = slot(req.id);
 
     // id exists already
-    if(rit != end()) {
+    if(s >= 0) {
         // move node to bucket tail
-        splice(end(), *this, rit);
-        
+        touch(s);
+
         // but address is new
-        if(std::find_if(rit->addresses.begin(), rit->addresses.end(), 
-            [&](const routing_table_entry::mi_addr& mi) { 
-                return mi.first == req.addr; 
-            }) == rit->addresses.end()) {
-            
+        packed_addr pa;
+        if(!packed_addr::pack(req.addr, pa)) {
+            spdlog::debug("routing: {} is not an IP address, not adding it to {}", req.addr.to_string(), util::htos(req.id));
+        } else if(address(s, pa) < 0) {
             // if limit reached, ignore
-            if(rit->addresses.size() < proto::table_entry_addr_limit) {
-                rit->addresses.emplace_back(req.addr, 0);
-                spdlog::debug("routing: new address for existing node {} found: {}, adding.", util::htos(rit->id), req.addr.to_string());
+            if(n_addrs[s] < addr_limit) {
+                add_address(s, pa);
+                spdlog::debug("routing: new address for existing node {} found: {}, adding.", util::htos(req.id), req.addr.to_string());
             }
         }
 
-        spdlog::debug("routing: exists already, moved node {} to tail. size: {}", util::htos(rit->id), size());
-    
+        spdlog::debug("routing: exists already, moved node {} to tail. size: {}", util::htos(req.id), size());
+
         last_seen = TIME_NOW();
     }
 }
 
 // entry isnt in own peer's bucket
-// if replies, 
+// if replies,
 void bucket::update_far_entry(net_peer req) {
-    if(empty()) 
+    if(empty())
         return;
 
-    net_contact contact(front());
-    spdlog::debug("routing: checking if node {} is alive", util::htos(contact.id));
+    net_contact front = contact(0);
+    spdlog::debug("routing: checking if node {} is alive", util::htos(front.id));
+
+    // the answer comes back on the continuation pool. go through the table so it's locked,
+    // and so the entry is found again even if this bucket has been split since
+    std::shared_ptr<routing_table> t = table;
+    hash_t pid = front.id;
 
     // try what addresses are available if the first doesnt work out
     table->net.send(true,
-        contact.addresses, proto::type::query, proto::actions::ping, 
+        front.addresses, proto::type::query, proto::actions::ping,
         table->id, util::msg_id(), msgpack::type::nil_t(),
-        [this, req](net_peer p, std::string) {
-            responded(p);
+        [t](net_peer p, proto::response_data) {
+            t->responded(p);
         },
-        [this](net_peer p) {
-            stale(p);
+        [t, pid](net_peer p) {
+            // timeouts only know the address
+            t->stale(net_peer(pid, p.addr));
+        }, rtt(0).rto);
+}
+
+/// @brief offer a free slot to the newest replacement cache candidate that isn't in the bucket already.
+/// it sat in the cache without being checked, so it's pinged and goes in through the table only if it answers
+void bucket::promote() {
+    net_peer c = empty_net_peer;
+
+    {
+        LOCK(cache_mutex);
+
+        while(!cache.empty() && slot(cache.back().id) >= 0)
+            cache.pop_back();
+
+        if(cache.empty())
+            return;
+
+        c = cache.back();
+        cache.pop_back();
+    }
+
+    spdlog::debug("routing: checking if candidate {} is alive", util::htos(c.id));
+
+    // the caller holds the table's write lock, so nothing here may go through the table
+    std::shared_ptr<routing_table> t = table;
+    hash_t pid = c.id;
+
+    table->net.send(true,
+        c.addr, proto::type::query, proto::actions::ping,
+        table->id, util::msg_id(), msgpack::type::nil_t(),
+        [t, pid](net_peer p, proto::response_data) {
+            // the address may have changed hands since
+            if(p.id == pid)
+                t->update(p);
+        },
+        [pid](net_peer) {
+            spdlog::debug("routing: candidate {} did not respond, dropping it", util::htos(pid));
         });
 }
 
 // add/update replacement cache
 void bucket::update_cache(net_peer req) {
     LOCK(cache_mutex);
-                
+
     // is node unknown
     auto cit = std::find_if(cache.begin(), cache.end(),
         [&](net_peer p) { return p.id == req.id; });
-    
+
     // node is unknown
     if(cit == cache.end()) {
         // is the cache full? kick out oldest node and add this one
@@ -153,7 +360,7 @@ void bucket::update_cache(net_peer req) {
             spdlog::debug("routing: replacement cache is full, removing oldest candidate");
             cache.pop_front();
         }
-        
+
         // node is unknown and doesn't exist in cache, add
         cache.push_back(req);
         spdlog::debug("routing: node {} is unknown, adding to replacement cache", util::htos(req.id));
@@ -165,4 +372,4 @@ void bucket::update_cache(net_peer req) {
 }
 
 }
-}
\ No newline at end of file
+}
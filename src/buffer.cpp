@@ -0,0 +1,23 @@
+#include "buffer.h"
+
+namespace lotus {
+namespace dht {
+
+template <typename T>
+static void add_ref(T* t) {
+    t->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T>
+static void release(T* t) {
+    if(t->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        t->pool->release(t);
+}
+
+void intrusive_ptr_add_ref(slab* s) { add_ref(s); }
+void intrusive_ptr_release(slab* s) { release(s); }
+void intrusive_ptr_add_ref(send_buffer* b) { add_ref(b); }
+void intrusive_ptr_release(send_buffer* b) { release(b); }
+
+}
+}
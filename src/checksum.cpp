@@ -0,0 +1,144 @@
+#include "util.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define CRC32C_HW
+#endif
+
+namespace lotus {
+namespace dht {
+namespace util {
+
+namespace {
+
+// reflected Castagnoli polynomial
+const u32 crc32c_poly = 0x82F63B78;
+
+/// @brief slicing-by-8 tables. t[0] is the byte-at-a-time table,
+/// t[k][b] is the CRC of byte b followed by k zero bytes
+struct crc32c_tables {
+    u32 t[8][256];
+
+    crc32c_tables() {
+        for(u32 i = 0; i < 256; i++) {
+            u32 c = i;
+            for(int j = 0; j < 8; j++)
+                c = (c >> 1) ^ (crc32c_poly & -(c & 1));
+            t[0][i] = c;
+        }
+
+        for(u32 i = 0; i < 256; i++)
+            for(int k = 1; k < 8; k++)
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+    }
+};
+
+const crc32c_tables tables;
+
+u32 load_le32(const u8* p) {
+    u32 v;
+    std::memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+u32 crc32c_sw(const u8* p, std::size_t n, u32 crc) {
+    const auto& t = tables.t;
+
+    while(n >= 8) {
+        u32 lo = load_le32(p) ^ crc;
+        u32 hi = load_le32(p + 4);
+
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+
+        p += 8;
+        n -= 8;
+    }
+
+    while(n--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+
+    return crc;
+}
+
+#ifdef CRC32C_HW
+// built for SSE4.2 regardless of the target flags, only called once cpuid says it's there
+__attribute__((target("sse4.2")))
+u32 crc32c_hw(const u8* p, std::size_t n, u32 crc) {
+#ifdef __x86_64__
+    u64 c = crc;
+
+    while(n >= 8) {
+        u64 v;
+        std::memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        n -= 8;
+    }
+
+    crc = static_cast<u32>(c);
+#endif
+
+    while(n >= 4) {
+        u32 v;
+        std::memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        n -= 4;
+    }
+
+    while(n--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+
+bool have_sse42() {
+    unsigned a, b, c, d;
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_2);
+}
+#endif
+
+using crc32c_fn = u32 (*)(const u8*, std::size_t, u32);
+
+#ifdef CRC32C_HW
+const crc32c_fn crc32c_impl = have_sse42() ? crc32c_hw : crc32c_sw;
+#else
+const crc32c_fn crc32c_impl = crc32c_sw;
+#endif
+
+}
+
+u32 crc32c(const void* data, std::size_t len, u32 crc) {
+    return ~crc32c_impl(static_cast<const u8*>(data), len, ~crc);
+}
+
+u32 crc32c_slicing8(const void* data, std::size_t len, u32 crc) {
+    return ~crc32c_sw(static_cast<const u8*>(data), len, ~crc);
+}
+
+#ifdef CRC32C_HW
+u32 crc32c_sse42(const void* data, std::size_t len, u32 crc) {
+    return ~crc32c_hw(static_cast<const u8*>(data), len, ~crc);
+}
+
+bool crc32c_has_sse42() {
+    return have_sse42();
+}
+#else
+u32 crc32c_sse42(const void* data, std::size_t len, u32 crc) {
+    return crc32c_slicing8(data, len, crc);
+}
+
+bool crc32c_has_sse42() {
+    return false;
+}
+#endif
+
+}
+}
+}
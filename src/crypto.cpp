@@ -4,120 +4,720 @@
 namespace lotus {
 namespace pki {
 
-crypto::crypto() { }
+// PSS salts and RSA blinding draw randomness. each thread gets its own pool
+static RandomNumberGenerator& thread_rng() {
+    thread_local AutoSeededRandomPool rng;
+    return rng;
+}
 
-std::string crypto::pub_key() {
-    std::string pk;
+// a Crypto++ object may only be used by one thread at a time, so every thread that signs
+// builds its own signer from the parsed key once. keyed by the private key's serial,
+// there are only ever a handful of private keys in a process
+template <typename S, typename K>
+static const S& thread_signer(u64 serial, const K& key) {
+    thread_local std::unordered_map<u64, std::unique_ptr<S>> signers;
+    std::unique_ptr<S>& s = signers[serial];
+
+    if(!s) {
+        s.reset(new S(key));
+
+        if(s->AccessKey().SupportsPrecomputation())
+            s->AccessKey().Precompute(16);
+    }
 
-    key_pair.pub_key.Save(StringSink(pk).Ref());
+    return *s;
+}
 
-    return pk;
+static u64 next_serial() {
+    static std::atomic<u64> serial(0);
+    return serial++;
 }
 
-void crypto::generate_keypair() {
-    InvertibleRSAFunction params;
-    params.GenerateRandomWithKeySize(rng, dht::proto::key_size);
+/// RSA
+
+class rsa_public_key : public public_key {
+public:
+    rsa_public_key(RSA::PublicKey k) : key(std::move(k)), verifier(key) { }
+
+    key_scheme scheme() const override { return key_scheme::rsa; }
+
+    bool verify(const std::string& message, const std::string& signature) const override {
+        try {
+            return verifier.VerifyMessage(
+                (const byte*)message.data(), message.size(),
+                (const byte*)signature.data(), signature.size());
+        } catch (std::exception& e) {
+            return false;
+        }
+    }
+
+    RSA::PublicKey key;
+    RSASS<PSSR, SHA256>::Verifier verifier; // built once, reused for every verify
+};
+
+class rsa_private_key : public private_key {
+public:
+    rsa_private_key(RSA::PublicKey pub, RSA::PrivateKey priv) : 
+        pub_key_(std::move(pub)), priv_key(std::move(priv)), serial(next_serial()) { }
+
+    key_scheme scheme() const override { return key_scheme::rsa; }
+
+    std::string pub_key() const override {
+        std::string pk;
+        pub_key_.Save(StringSink(pk).Ref());
+        return pk;
+    }
+
+    std::shared_ptr<const public_key> public_part() const override {
+        return std::make_shared<rsa_public_key>(pub_key_);
+    }
+
+    std::string sign(const std::string& message) const override {
+        const RSASS<PSSR, SHA256>::Signer& signer = thread_signer<RSASS<PSSR, SHA256>::Signer>(serial, priv_key);
+        std::string signature(signer.MaxSignatureLength(), '\0');
+
+        std::size_t n = signer.SignMessage(thread_rng(), 
+            (const byte*)message.data(), message.size(), (byte*)&signature[0]);
+        signature.resize(n);
+
+        return signature;
+    }
+
+    void save(std::string pub_filename, std::string priv_filename) const override {
+        pub_key_.BEREncode(FileSink(pub_filename.c_str(), true).Ref());
+        priv_key.DEREncode(FileSink(priv_filename.c_str(), true).Ref());
+    }
+
+    RSA::PublicKey pub_key_;
+    RSA::PrivateKey priv_key;
+    u64 serial; // picks this key's signer on each thread
+};
+
+/// Ed25519
+
+class ed25519_public_key : public public_key {
+public:
+    ed25519_public_key(const ed25519::Signer& s) : verifier(s) { }
+    ed25519_public_key(const std::string& s) {
+        verifier.AccessPublicKey().Load(StringSource(s, true).Ref());
+    }
+
+    key_scheme scheme() const override { return key_scheme::ed25519; }
+
+    bool verify(const std::string& message, const std::string& signature) const override {
+        return verifier.VerifyMessage(
+            (const byte*)message.data(), message.size(),
+            (const byte*)signature.data(), signature.size());
+    }
 
-    key_pair.priv_key = RSA::PrivateKey(params);
-    key_pair.pub_key = RSA::PublicKey(params);
+    ed25519::Verifier verifier;
+};
+
+class ed25519_private_key : public private_key {
+public:
+    ed25519_private_key(RandomNumberGenerator& rng) : signer(rng), serial(next_serial()) { }
+    ed25519_private_key(std::string priv_filename) : serial(next_serial()) {
+        signer.AccessPrivateKey().Load(FileSource(priv_filename.c_str(), true).Ref());
+    }
+
+    key_scheme scheme() const override { return key_scheme::ed25519; }
+
+    std::string pub_key() const override {
+        std::string pk;
+        ed25519::Verifier(signer).GetPublicKey().Save(StringSink(pk).Ref());
+        return pk;
+    }
+
+    std::shared_ptr<const public_key> public_part() const override {
+        return std::make_shared<ed25519_public_key>(signer);
+    }
+
+    // deterministic, the rng is unused
+    std::string sign(const std::string& message) const override {
+        const ed25519::Signer& s = thread_signer<ed25519::Signer>(serial, signer.GetPrivateKey());
+        std::string signature(s.MaxSignatureLength(), '\0');
+
+        std::size_t n = s.SignMessage(thread_rng(), 
+            (const byte*)message.data(), message.size(), (byte*)&signature[0]);
+        signature.resize(n);
+
+        return signature;
+    }
+
+    void save(std::string pub_filename, std::string priv_filename) const override {
+        ed25519::Verifier(signer).GetPublicKey().Save(FileSink(pub_filename.c_str(), true).Ref());
+        signer.GetPrivateKey().Save(FileSink(priv_filename.c_str(), true).Ref());
+    }
+
+    ed25519::Signer signer; // holds the key, signing goes through a per-thread copy
+    u64 serial;
+};
+
+/// factories
+
+std::shared_ptr<const public_key> public_key::load(const std::string& s) {
+    if(s.empty())
+        return nullptr;
+
+    // the algorithm OID in the encoded key tells the schemes apart
+    try {
+        RSA::PublicKey pk;
+        pk.Load(StringSource(s, true).Ref());
+        return std::make_shared<rsa_public_key>(std::move(pk));
+    } catch (std::exception&) { }
+
+    try {
+        return std::make_shared<ed25519_public_key>(s);
+    } catch (std::exception&) { }
+
+    return nullptr;
 }
 
-void crypto::import_keypair(keypair kp) {
-    key_pair.priv_key = kp.priv_key;
-    key_pair.pub_key = kp.pub_key;
+std::unique_ptr<private_key> private_key::generate(key_scheme scheme, RandomNumberGenerator& rng) {
+    switch(scheme) {
+    case key_scheme::ed25519:
+        return std::unique_ptr<private_key>(new ed25519_private_key(rng));
+
+    case key_scheme::rsa:
+    default:
+        {
+            InvertibleRSAFunction params;
+            params.GenerateRandomWithKeySize(rng, dht::proto::key_size);
+
+            return std::unique_ptr<private_key>(
+                new rsa_private_key(RSA::PublicKey(params), RSA::PrivateKey(params)));
+        }
+    }
 }
 
-void crypto::import_file(std::string pub_filename, std::string priv_filename) {
-    key_pair.pub_key.BERDecode(FileSource(pub_filename.c_str(), true).Ref());
-    key_pair.priv_key.BERDecode(FileSource(priv_filename.c_str(), true).Ref());
+std::unique_ptr<private_key> private_key::load(std::string pub_filename, std::string priv_filename) {
+    try {
+        RSA::PublicKey pub;
+        RSA::PrivateKey priv;
+        pub.BERDecode(FileSource(pub_filename.c_str(), true).Ref());
+        priv.BERDecode(FileSource(priv_filename.c_str(), true).Ref());
+
+        return std::unique_ptr<private_key>(new rsa_private_key(std::move(pub), std::move(priv)));
+    } catch (std::exception&) { }
+
+    return std::unique_ptr<private_key>(new ed25519_private_key(priv_filename));
 }
 
-void crypto::export_keypair(keypair& kp) {
-    kp.priv_key = key_pair.priv_key;
-    kp.pub_key = key_pair.pub_key;
+/// verify cache
+
+verify_cache::verify_cache(std::size_t n) : 
+    capacity(std::max<std::size_t>(1, n / dht::proto::queue_shards)), 
+    n_hits(0), n_misses(0) { }
+
+/// @brief SHA-256(id || SHA-256(message) || signature)
+verify_cache::digest verify_cache::key(dht::hash_t id, const std::string& message, const std::string& signature) {
+    digest d, m;
+    byte i[dht::hash_t::bytes];
+    SHA256 h;
+
+    id.to_bytes(i);
+
+    h.CalculateDigest(m.data(), (const byte*)message.data(), message.size());
+
+    h.Update(i, sizeof(i));
+    h.Update(m.data(), m.size());
+    h.Update((const byte*)signature.data(), signature.size());
+    h.Final(d.data());
+
+    return d;
 }
 
-void crypto::export_file(std::string pub_filename, std::string priv_filename) {
-    key_pair.pub_key.BEREncode(FileSink(pub_filename.c_str(), true).Ref());
-    key_pair.priv_key.DEREncode(FileSink(priv_filename.c_str(), true).Ref());
+bool verify_cache::contains(const digest& d) {
+    shard& s = shard_for(d);
+    bool hit;
+
+    {
+        LOCK(s.mutex);
+        hit = s.set.find(d) != s.set.end();
+    }
+
+    if(hit) n_hits++;
+    else n_misses++;
+
+    return hit;
 }
 
-std::string crypto::sign(std::string message) {
-    std::string signature;
-    RSASS<PSSR, SHA256>::Signer signer(key_pair.priv_key);
+void verify_cache::insert(const digest& d) {
+    shard& s = shard_for(d);
+
+    LOCK(s.mutex);
+    if(!s.set.insert(d).second)
+        return;
 
-    StringSource s1(message, true, new SignerFilter(rng, signer, new StringSink(signature)));
+    s.order.push_back(d);
 
-    return signature;
+    if(s.order.size() > capacity) {
+        s.set.erase(s.order.front());
+        s.order.pop_front();
+    }
 }
 
-bool crypto::verify(RSA::PublicKey pk, std::string message, std::string signature) {
-    try {
-        RSASS<PSSR, SHA256>::Verifier verifier(pk);
+std::size_t verify_cache::size() {
+    std::size_t n = 0;
+
+    for(auto& s : shards) {
+        LOCK(s.mutex);
+        n += s.set.size();
+    }
+
+    return n;
+}
 
-        StringSource s1(message+signature, true, 
-            new SignatureVerificationFilter(
-                verifier, NULL, SignatureVerificationFilter::THROW_EXCEPTION
-            )
-        );
+/// keystore
 
-        return true;
-    } catch (std::exception& e) {
+keystore::keystore(std::size_t n) : 
+    shard_capacity(std::max<std::size_t>(1, n / dht::proto::queue_shards)), 
+    records(0),
+    n_hits(0), n_misses(0), n_evictions(0) { }
+
+std::size_t keystore::open(const std::string& filename) {
+    std::size_t loaded = 0;
+
+    {
+        std::ifstream in(filename, std::ios::binary);
+        unsigned char len[2];
+
+        // a torn record at the end (crash mid-append) just ends the file
+        while(in.read((char*)len, sizeof(len))) {
+            std::string s((len[0] << 8) | len[1], '\0');
+            if(!in.read(&s[0], s.size()))
+                break;
+
+            // keys are self-certifying, the id is the hash of the key
+            std::shared_ptr<const public_key> pk = public_key::load(s);
+            if(pk && insert(dht::util::hash(s), s, std::move(pk)))
+                loaded++;
+        }
+    }
+
+    LOCK(file_mutex);
+    path = filename;
+    compact();
+
+    return loaded;
+}
+
+/// @note caller holds the shard lock
+std::shared_ptr<const public_key> keystore::touch(shard& s, dht::hash_t h) {
+    auto it = s.map.find(h);
+    if(it == s.map.end())
+        return nullptr;
+
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    return it->second->key;
+}
+
+std::shared_ptr<const public_key> keystore::get(dht::hash_t h) {
+    shard& s = shard_for(h);
+    std::shared_ptr<const public_key> k;
+
+    {
+        LOCK(s.mutex);
+        k = touch(s, h);
+    }
+
+    if(k) n_hits++;
+    else n_misses++;
+
+    return k;
+}
+
+bool keystore::has(dht::hash_t h) {
+    return get(h) != nullptr;
+}
+
+void keystore::put(dht::hash_t h, std::string encoded, std::shared_ptr<const public_key> k) {
+    std::string record = encoded;
+
+    if(insert(h, std::move(encoded), std::move(k)))
+        append(record);
+}
+
+bool keystore::insert(dht::hash_t h, std::string encoded, std::shared_ptr<const public_key> k) {
+    shard& s = shard_for(h);
+
+    LOCK(s.mutex);
+    if(touch(s, h))
         return false;
+
+    s.lru.push_front(entry{ h, std::move(encoded), std::move(k) });
+    s.map.emplace(h, s.lru.begin());
+
+    if(s.lru.size() > shard_capacity) {
+        s.map.erase(s.lru.back().id);
+        s.lru.pop_back();
+        n_evictions++;
+    }
+
+    return true;
+}
+
+void keystore::append(const std::string& encoded) {
+    LOCK(file_mutex);
+    if(!file.is_open() || encoded.size() > 0xffff)
+        return;
+
+    unsigned char len[2] = { (unsigned char)(encoded.size() >> 8), (unsigned char)encoded.size() };
+    file.write((const char*)len, sizeof(len));
+    file.write(encoded.data(), encoded.size());
+    file.flush();
+
+    // evicted and deleted keys stay in the file until the next rewrite
+    if(++records > 2 * capacity())
+        compact();
+}
+
+/// @brief rewrite the file with only the keys currently held, least recently used first
+/// so that loading it back leaves them in the same order
+/// @note caller holds file_mutex
+void keystore::compact() {
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    std::size_t n = 0;
+
+    for(auto& s : shards) {
+        LOCK(s.mutex);
+
+        for(auto e = s.lru.rbegin(); e != s.lru.rend(); ++e) {
+            if(e->encoded.size() > 0xffff)
+                continue;
+
+            unsigned char len[2] = { (unsigned char)(e->encoded.size() >> 8), (unsigned char)e->encoded.size() };
+            out.write((const char*)len, sizeof(len));
+            out.write(e->encoded.data(), e->encoded.size());
+            n++;
+        }
+    }
+
+    out.close();
+    file.close();
+
+    if(!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        spdlog::warn("keystore: couldn't write {}, keys will not persist", path);
+        return;
+    }
+
+    file.open(path, std::ios::binary | std::ios::app);
+    records = n;
+}
+
+void keystore::del(dht::hash_t h) {
+    shard& s = shard_for(h);
+
+    LOCK(s.mutex);
+    auto it = s.map.find(h);
+    if(it == s.map.end())
+        return;
+
+    s.lru.erase(it->second);
+    s.map.erase(it);
+}
+
+std::size_t keystore::size() {
+    std::size_t n = 0;
+
+    for(auto& s : shards) {
+        LOCK(s.mutex);
+        n += s.lru.size();
     }
+
+    return n;
+}
+
+/// crypto
+
+crypto::crypto() : 
+    verified(dht::constants::verify_cache_size),
+    ks(dht::constants::keystore_size),
+    drainers(0),
+    pool(dht::constants::crypto_threads) { }
+
+std::string crypto::pub_key() {
+    return key->pub_key();
+}
+
+key_scheme crypto::scheme() {
+    return key->scheme();
+}
+
+void crypto::generate_keypair(key_scheme s) {
+    {
+        LOCK(rng_mutex);
+        key = private_key::generate(s, rng);
+    }
+
+    own_key = key->public_part();
+}
+
+void crypto::import_keypair(keypair kp) {
+    key.reset(new rsa_private_key(kp.pub_key, kp.priv_key));
+    own_key = key->public_part();
+}
+
+void crypto::import_file(std::string pub_filename, std::string priv_filename) {
+    key = private_key::load(pub_filename, priv_filename);
+    own_key = key->public_part();
+}
+
+void crypto::export_keypair(keypair& kp) {
+    const rsa_private_key* k = dynamic_cast<const rsa_private_key*>(key.get());
+    if(k == nullptr)
+        throw std::runtime_error("keypair is not RSA");
+
+    kp.priv_key = k->priv_key;
+    kp.pub_key = k->pub_key_;
+}
+
+void crypto::export_file(std::string pub_filename, std::string priv_filename) {
+    key->save(pub_filename, priv_filename);
+}
+
+std::string crypto::sign(std::string message) {
+    return key->sign(message);
+}
+
+bool crypto::verify(const public_key& pk, std::string message, std::string signature) {
+    return pk.verify(message, signature);
 }
 
 bool crypto::verify(std::string message, std::string signature) {
-    return verify(key_pair.pub_key, message, signature);
+    return verify(*own_key, message, signature);
 }
 
 bool crypto::verify(dht::hash_t id, std::string message, std::string signature) {
     auto k = ks_get(id);
 
-    if(!k.has_value())
+    if(!k)
         return false;
 
-    bool v = verify(k.value(), message, signature);
+    // same signed blob from the same peer again
+    verify_cache::digest d = verify_cache::key(id, message, signature);
+    if(verified.contains(d))
+        return true;
+
+    bool v = verify(*k, message, signature);
 
     // remove from local keystore
     if(!v)
         ks_del(id);
+    else
+        verified.insert(d);
 
     return v;
 }
 
-boost::optional<RSA::PublicKey> crypto::ks_get(dht::hash_t h) {
-    LOCK(ks_mutex);
-    return (ks.find(h) != ks.end()) ? 
-        boost::optional<RSA::PublicKey>(ks[h]) : boost::none;
+std::shared_ptr<const public_key> crypto::ks_get(dht::hash_t h) {
+    return ks.get(h);
 }
 
 void crypto::ks_del(dht::hash_t h) {
-    LOCK(ks_mutex);
-    ks.erase(h);
+    ks.del(h);
 }
 
 void crypto::ks_put(dht::hash_t h, std::string s) {
-    if(s.empty() || ks_get(h).has_value())
+    if(s.empty() || ks.has(h))
         return;
 
-    LOCK(ks_mutex);
-    RSA::PublicKey pk;
+    // parse outside any lock
+    std::shared_ptr<const public_key> pk = public_key::load(s);
+    if(!pk)
+        return;
 
-    try {
-        pk.Load(StringSource(s, true).Ref());
-        ks[h] = std::move(pk);
-    } catch (std::exception& e) { }
+    ks.put(h, std::move(s), std::move(pk));
 }
 
 bool crypto::ks_has(dht::hash_t h) {
-    LOCK(ks_mutex);
-    return ks.find(h) != ks.end();
+    return ks.has(h);
+}
+
+std::size_t crypto::ks_open(std::string filename) {
+    return ks.open(filename);
 }
 
 bool crypto::validate(dht::kv vl) {
     return verify(vl.origin.id, vl.sig_blob(), vl.signature);
 }
 
+/// sessions
+
+crypto::ephemeral crypto::session_begin() {
+    x25519 dh;
+    ephemeral e { SecByteBlock(x25519::SECRET_KEYLENGTH), std::string(x25519::PUBLIC_KEYLENGTH, '\0') };
+
+    dh.GenerateKeyPair(thread_rng(), e.secret.data(), (byte*)&e.pub[0]);
+    return e;
+}
+
+/// @brief derive a session key from our ephemeral secret and the peer's ephemeral public key
+bool crypto::session_put(std::string name, const ephemeral& ours, const std::string& theirs) {
+    if(theirs.size() != x25519::PUBLIC_KEYLENGTH)
+        return false;
+
+    x25519 dh;
+    SecByteBlock shared(x25519::SHARED_KEYLENGTH);
+    if(!dh.Agree(shared.data(), ours.secret.data(), (const byte*)theirs.data()))
+        return false;
+
+    // key = SHA-256(shared || lower public key || higher public key), same on both ends
+    const std::string& lo = std::min(ours.pub, theirs);
+    const std::string& hi = std::max(ours.pub, theirs);
+
+    session s;
+    SHA256 h;
+    h.Update(shared.data(), shared.size());
+    h.Update((const byte*)lo.data(), lo.size());
+    h.Update((const byte*)hi.data(), hi.size());
+    h.Final(s.key.data());
+
+    s.name = name;
+    s.expires = steady_clock::now() + seconds(dht::constants::session_ttl);
+
+    LOCK(sessions_mutex);
+
+    auto it = sessions.find(name);
+    if(it != sessions.end()) {
+        session_lru.erase(it->second);
+        sessions.erase(it);
+    }
+
+    // full, drop the session that went unused the longest
+    if(sessions.size() >= (std::size_t)dht::constants::session_size) {
+        sessions.erase(session_lru.back().name);
+        session_lru.pop_back();
+    }
+
+    session_lru.push_front(std::move(s));
+    sessions.emplace(name, session_lru.begin());
+    return true;
+}
+
+/// @brief copy out the key of a live session and mark it used. expired sessions are dropped here
+bool crypto::session_key(const std::string& name, std::array<byte, SHA256::DIGESTSIZE>& key) {
+    LOCK(sessions_mutex);
+
+    auto it = sessions.find(name);
+    if(it == sessions.end())
+        return false;
+
+    if(it->second->expires <= steady_clock::now()) {
+        session_lru.erase(it->second);
+        sessions.erase(it);
+        return false;
+    }
+
+    session_lru.splice(session_lru.begin(), session_lru, it->second);
+    key = it->second->key;
+    return true;
+}
+
+bool crypto::session_has(std::string name) {
+    std::array<byte, SHA256::DIGESTSIZE> key;
+    return session_key(name, key);
+}
+
+void crypto::session_del(std::string name) {
+    LOCK(sessions_mutex);
+
+    auto it = sessions.find(name);
+    if(it == sessions.end())
+        return;
+
+    session_lru.erase(it->second);
+    sessions.erase(it);
+}
+
+/// @return empty if there is no live session
+std::string crypto::session_mac(std::string name, const std::string& message) {
+    std::array<byte, SHA256::DIGESTSIZE> key;
+
+    if(!session_key(name, key))
+        return "";
+
+    std::string tag(HMAC<SHA256>::DIGESTSIZE, '\0');
+    HMAC<SHA256> mac(key.data(), key.size());
+    mac.CalculateDigest((byte*)&tag[0], (const byte*)message.data(), message.size());
+
+    return tag;
+}
+
+bool crypto::session_verify(std::string name, const std::string& message, const std::string& tag) {
+    std::array<byte, SHA256::DIGESTSIZE> key;
+
+    if(tag.size() != HMAC<SHA256>::DIGESTSIZE || !session_key(name, key))
+        return false;
+
+    HMAC<SHA256> mac(key.data(), key.size());
+    return mac.VerifyDigest((const byte*)tag.data(), (const byte*)message.data(), message.size());
+}
+
+/// async
+
+void crypto::async_sign(std::string message, std::function<void(std::string)> cb) {
+    submit([this, message = std::move(message), cb]() {
+        std::string s = sign(message);
+        completions([cb, s = std::move(s)]() { cb(s); });
+    });
+}
+
+void crypto::async_verify(dht::hash_t id, std::string message, std::string signature, std::function<void(bool)> cb) {
+    submit([this, id, message = std::move(message), signature = std::move(signature), cb]() {
+        bool v = verify(id, message, signature);
+        completions([cb, v]() { cb(v); });
+    });
+}
+
+void crypto::async_validate(dht::kv vl, std::function<void(bool)> cb) {
+    submit([this, vl = std::move(vl), cb]() {
+        bool v = validate(vl);
+        completions([cb, v]() { cb(v); });
+    });
+}
+
+void crypto::submit(std::function<void()> job) {
+    bool wake;
+
+    {
+        LOCK(jobs_mutex);
+        jobs.push_back(std::move(job));
+
+        wake = drainers < dht::constants::crypto_threads;
+        if(wake) drainers++;
+    }
+
+    if(wake)
+        boost::asio::post(pool, [this]() { drain(); });
+}
+
+void crypto::drain() {
+    std::vector<std::function<void()>> batch;
+    batch.reserve(dht::constants::crypto_batch);
+
+    while(true) {
+        {
+            LOCK(jobs_mutex);
+
+            if(jobs.empty()) {
+                drainers--;
+                return;
+            }
+
+            while(!jobs.empty() && batch.size() < (std::size_t)dht::constants::crypto_batch) {
+                batch.push_back(std::move(jobs.front()));
+                jobs.pop_front();
+            }
+        }
+
+        for(auto& j : batch)
+            j();
+
+        batch.clear();
+    }
+}
+
+}
 }
-}
\ No newline at end of file
@@ -5,11 +5,13 @@
 namespace lotus {
 namespace dht {
 
-node::node(bool local, u16 port) :
-    net(local, port, std::bind(&node::handler, this, _1, _2)),
+node::node(bool local, u16 port, std::size_t threads) :
+    flat_table(constants::flat_table),
+    running(false),
+    net(local, port, std::bind(&node::handler, this, _1, _2), threads),
     reng(rd()),
     treng(rd()),
-    running(false) {
+    n_coalesced(0) {
     std::srand(util::time_now());
 }
 
@@ -24,15 +26,34 @@ hash_t node::get_id() const {
     return id;
 } 
 
+boost::optional<rtt_estimator> node::rtt(hash_t peer) {
+    return table->rtt(peer);
+}
+
 /// runners
 
 void node::_run() {
     id = util::hash(crypto.pub_key());
 
-    table = std::make_shared<routing_table>(id, net);
+    if(flat_table)
+        table = std::make_shared<lotus::dht::flat_table>(id, net);
+    else
+        table = std::make_shared<trie_table>(id, net);
+
     table_ref = table;
     table->init();
 
+    // crypto completions continue on the network's callback pool, never on a receive thread
+    crypto.completions = [this](std::function<void()> f) {
+        net.post(std::move(f));
+    };
+
+    // feed round trip times into the routing table's per-peer estimators
+
+    net.queue.on_rtt = [this](net_peer p, milliseconds rtt) {
+        table->rtt_sample(p, rtt);
+    };
+
     spdlog::debug("dht: running DHT node on port {} (id: {})", net.port, dec(id));
     
     running = true;
@@ -44,11 +65,13 @@ void node::_run() {
     refresh_thread = std::thread([&, this]() {
         while(true) {
             std::this_thread::sleep_for(seconds(proto::refresh_interval));
-            table->dfs([&, this](tree* ptr) {
-                auto time_since = util::time_now() - ptr->data.last_seen;
+
+            // refreshing looks up nodes, so the table can't stay locked meanwhile
+            for(const auto& r : table->ranges()) {
+                auto time_since = util::time_now() - r.last_seen;
                 if(time_since > proto::refresh_time)
-                    refresh(ptr);
-            });
+                    refresh(r);
+            }
         }
     });
 
@@ -89,6 +112,12 @@ void node::export_keypair(std::string pub_filename, std::string priv_filename) {
     crypto.export_file(pub_filename, priv_filename);
 }
 
+/// @brief persist peer keys to a file, peers known from the last run skip identify
+void node::open_keystore(std::string filename) {
+    std::size_t n = crypto.ks_open(filename);
+    spdlog::debug("dht: loaded {} peer keys from {}", n, filename);
+}
+
 /// handlers
 
 void node::_handler(net_peer peer, proto::message msg) {
@@ -117,7 +146,8 @@ void node::_handler(net_peer peer, proto::message msg) {
 void node::handler(net_peer peer, proto::message msg) {
     // identify before any query
     if(!crypto.ks_has(peer.id) && msg.a != proto::actions::identify) {
-        identify(resolve_peer_in_table(peer), 
+        // check the address it wrote from, not ones the table may already have for that ID
+        identify(peer, 
             [this, msg](net_peer peer, std::string key) {
                 _handler(std::move(peer), std::move(msg));
             },
@@ -134,7 +164,7 @@ void node::handle_ping(net_peer peer, proto::message msg) {
             id, msg.q, msgpack::type::nil_t(),
             net.queue.q_nothing, net.queue.f_nothing);
     } else if(msg.m == proto::type::response) {
-        net.queue.satisfy(peer, msg.q, std::string{});
+        net.queue.satisfy(peer, msg.q, boost::blank());
     }
 }
 
@@ -143,8 +173,12 @@ void node::handle_store(net_peer peer, proto::message msg) {
         proto::store_query_data d;
         msg.d.convert(d);
 
-        hash_t k(enc(d.k));
-        u32 chksum = util::crc32b((u8*)d.v.data());
+        hash_t k = d.k;
+
+        // answer in whichever checksum the querier knows
+        u32 chksum = msg.s >= proto::crc32c_schema ?
+            util::crc32c(d.v.data(), d.v.size()) :
+            util::crc32b((u8*)d.v.data());
 
         int s = proto::status::ok;
         
@@ -165,12 +199,8 @@ void node::handle_store(net_peer peer, proto::message msg) {
 
         // we don't care about the timestamp
 
-        // find a more elegant way to do this
-        std::stringstream ss;
-        ss << d.c;
-
         if(d.s == proto::status::ok)
-            net.queue.satisfy(peer, msg.q, ss.str());
+            net.queue.satisfy(peer, msg.q, std::move(d));
 
         table->update(peer);
     }
@@ -181,47 +211,35 @@ void node::handle_find_node(net_peer peer, proto::message msg) {
         proto::find_query_data d;
         msg.d.convert(d);
 
-        hash_t target_id(enc(d.t));
-        const bucket& bkt = table->find_bucket(target_id);
+        hash_t target_id = d.t;
+        std::vector<net_contact> nearest = table->closest(target_id, proto::bucket_size);
 
         std::vector<proto::peer_object> b;
         /// @todo HACKY!!! WE WILL REMOVE THIS WHEN WE CAN ADDRESS PEERS BY IDs ONLY
-        for(auto i : bkt) {
-            for(auto a : i.addresses) {
+        for(const auto& c : nearest) {
+            for(const auto& a : c.addresses) {
                 b.emplace_back(
-                    a.first.transport(), 
-                    a.first.addr, 
-                    a.first.port, 
-                    dec(target_id)
+                    a.transport(), 
+                    a.addr, 
+                    a.port, 
+                    c.id
                 );
             }
         }
 
-        std::stringstream ss;
-        msgpack::pack(ss, b);
-
-        proto::find_node_resp_data resp {
-            .b = std::move(b),
-            .s = crypto.sign(ss.str())
-        };
-
-        net.send(false,
-            peer.addr, proto::type::response, proto::actions::find_node,
-            id, msg.q, resp,
-            net.queue.q_nothing, net.queue.f_nothing);
+        sign_bucket(peer, d.m, msg.s >= proto::binary_id_schema, std::move(b), [this, peer, q = msg.q](proto::find_node_resp_data r) {
+            net.send(false,
+                peer.addr, proto::type::response, proto::actions::find_node,
+                id, q, r,
+                net.queue.q_nothing, net.queue.f_nothing);
+        });
 
         table->update(peer);
     } else if(msg.m == proto::type::response) {
         proto::find_node_resp_data d;
-        msgpack::object_handle oh;
-
         msg.d.convert(d);
 
-        // hacky, repack
-        std::stringstream ss;
-        msgpack::pack(ss, d);
-
-        net.queue.satisfy(peer, msg.q, ss.str());
+        net.queue.satisfy(peer, msg.q, std::move(d));
         
         table->update(peer);
     }
@@ -232,7 +250,7 @@ void node::handle_find_value(net_peer peer, proto::message msg) {
         proto::find_query_data d;
         msg.d.convert(d);
 
-        hash_t target_id(enc(d.t));
+        hash_t target_id = d.t;
 
         {
             LOCK(ht_mutex);
@@ -251,33 +269,27 @@ void node::handle_find_value(net_peer peer, proto::message msg) {
                     net.queue.q_nothing, net.queue.f_nothing);
             } else {
                 // key does not exist in hash table
-                const bucket& bkt = table->find_bucket(target_id);
+                std::vector<net_contact> nearest = table->closest(target_id, proto::bucket_size);
 
                 std::vector<proto::peer_object> b;
                 /// @todo HACKY!!! WE WILL REMOVE THIS WHEN WE CAN ADDRESS PEERS BY IDs ONLY
-                for(auto i : bkt) {
-                    for(auto a : i.addresses) {
+                for(const auto& c : nearest) {
+                    for(const auto& a : c.addresses) {
                         b.emplace_back(
-                            a.first.transport(), 
-                            a.first.addr, 
-                            a.first.port, 
-                            dec(target_id)
+                            a.transport(), 
+                            a.addr, 
+                            a.port, 
+                            c.id
                         );
                     }
                 }
 
-                std::stringstream ss;
-                msgpack::pack(ss, b);
-
-                proto::find_node_resp_data resp {
-                    .b = std::move(b),
-                    .s = crypto.sign(ss.str())
-                };
-
-                net.send(false,
-                    peer.addr, proto::type::response, proto::actions::find_value,
-                    id, msg.q, proto::find_value_resp_data { .v = boost::none, .b = resp },
-                    net.queue.q_nothing, net.queue.f_nothing);
+                sign_bucket(peer, d.m, msg.s >= proto::binary_id_schema, std::move(b), [this, peer, q = msg.q](proto::find_node_resp_data r) {
+                    net.send(false,
+                        peer.addr, proto::type::response, proto::actions::find_value,
+                        id, q, proto::find_value_resp_data { .v = boost::none, .b = std::move(r) },
+                        net.queue.q_nothing, net.queue.f_nothing);
+                });
             }
         }
 
@@ -286,11 +298,7 @@ void node::handle_find_value(net_peer peer, proto::message msg) {
         proto::find_value_resp_data d;
         msg.d.convert(d);
 
-        // hacky, repack
-        std::stringstream ss;
-        msgpack::pack(ss, d);
-        
-        net.queue.satisfy(peer, msg.q, ss.str());
+        net.queue.satisfy(peer, msg.q, std::move(d));
 
         table->update(peer);
     }
@@ -301,24 +309,48 @@ void node::handle_identify(net_peer peer, proto::message msg) {
         proto::identify_query_data d;
         msg.d.convert(d);
 
-        net.send(false,
-            peer.addr, proto::type::response, proto::actions::identify,
-            id, msg.q, proto::identify_resp_data{
-                .k = crypto.pub_key(),
-                .s = crypto.sign(
-                    fmt::format("{}:{}:{}", 
-                        d.s, peer.addr.addr, peer.addr.port)) // sign secret token
-            },
-            net.queue.q_nothing, net.queue.f_nothing);
+        // we answer all the same, but the peer won't be able to read the key
+        if(msg.s < proto::ed25519_schema && crypto.scheme() == pki::key_scheme::ed25519)
+            spdlog::debug("dht: {} speaks schema {} and can't parse our Ed25519 key", peer.addr.to_string(), msg.s);
+
+        std::string blob = fmt::format("{}:{}:{}", d.s, peer.addr.addr, peer.addr.port);
+        boost::optional<std::string> e;
+
+        // peer offered an ephemeral key: answer with ours and bind both halves into the signature
+        if(constants::session_macs && d.e.has_value()) {
+            std::shared_ptr<pki::crypto::ephemeral> eph = 
+                std::make_shared<pki::crypto::ephemeral>(crypto.session_begin());
+
+            blob += ":" + d.e.value() + ":" + eph->pub;
+            e = eph->pub;
+
+            // anyone can claim an ID in a query. keep the session only once the peer has proven it
+            // at this address, with a handshake of our own that offers no key back. until then its
+            // MAC'd queries are answered with signatures
+            identify(peer, 
+                [this, peer, eph, theirs = d.e.value()](net_peer, std::string) {
+                    crypto.session_put(session_from(peer), *eph, theirs);
+                }, 
+                basic_nothing, false);
+        }
+
+        // sign secret token
+        crypto.async_sign(std::move(blob),
+            [this, peer, q = msg.q, e](std::string sig) {
+                net.send(false,
+                    peer.addr, proto::type::response, proto::actions::identify,
+                    id, q, proto::identify_resp_data{
+                        .k = crypto.pub_key(),
+                        .s = std::move(sig),
+                        .e = e
+                    },
+                    net.queue.q_nothing, net.queue.f_nothing);
+            });
     } else if(msg.m == proto::type::response) {
         proto::identify_resp_data d;
         msg.d.convert(d);
-        
-        // hacky, repack
-        std::stringstream ss;
-        msgpack::pack(ss, d);
 
-        net.queue.satisfy(peer, msg.q, ss.str());
+        net.queue.satisfy(peer, msg.q, std::move(d));
 
         /// @note identify does not update table
     }
@@ -331,7 +363,7 @@ void node::handle_get_addresses(net_peer peer, proto::message msg) {
 
         std::vector<proto::address_object> addrs;
 
-        hash_t target_id = enc(d.i);
+        hash_t target_id = d.i;
         boost::optional<routing_table_entry> c = table->find(target_id);
         
         if(c.has_value()) {
@@ -351,11 +383,7 @@ void node::handle_get_addresses(net_peer peer, proto::message msg) {
         proto::get_addresses_resp_data d;
         msg.d.convert(d);
 
-        // hacky, repack
-        std::stringstream ss;
-        msgpack::pack(ss, d);
-
-        net.queue.satisfy(peer, msg.q, ss.str());
+        net.queue.satisfy(peer, msg.q, std::move(d));
 
         /// @note get_addresses does not update table
     }
@@ -370,21 +398,31 @@ void node::put(std::string key, std::string value) {
 void node::get(std::string key, value_callback cb) {
     std::list<fv_value> l = disjoint_lookup_value(util::hash(key), proto::quorum);
     std::vector<kv> values;
+    std::vector<std::future<bool>> checks;
 
     for(auto i : l) {
         if(i.type() == typeid(boost::blank) ||
-            i.type() == typeid(bucket))
+            i.type() == typeid(std::list<net_contact>))
             continue;
         else if(i.type() == typeid(kv)) {
             kv v = boost::get<kv>(i);
 
-            // get will only fetch valid data
-            if(crypto.validate(v))
-                values.push_back(v);
+            // validate all candidates side by side on the crypto pool
+            std::shared_ptr<std::promise<bool>> prom = std::make_shared<std::promise<bool>>();
+            checks.push_back(prom->get_future());
+            crypto.async_validate(v, [prom](bool ok) { prom->set_value(ok); });
+
+            values.push_back(std::move(v));
         }
     }
 
-    cb(std::move(values));
+    // get will only fetch valid data
+    std::vector<kv> valid;
+    for(std::size_t i = 0; i < values.size(); i++)
+        if(checks[i].get())
+            valid.push_back(std::move(values[i]));
+
+    cb(std::move(valid));
 }
 
 void node::provide(std::string key, net_peer provider) {
@@ -422,18 +460,20 @@ void node::ping(net_contact contact, basic_callback ok, basic_callback bad) {
     net.send(true,
         contact.addresses, proto::type::query, proto::actions::ping,
         id, util::msg_id(), msgpack::type::nil_t(),
-        [this, ok](net_peer p_, std::string s) { 
+        [this, ok](net_peer p_, proto::response_data) { 
             table->update(p_);
             ok(p_); 
         },
-        [this, bad](net_peer p_) {
-            table->stale(p_);
-            bad(p_); 
-        });
+        [this, bad, pid = contact.id](net_peer p_) {
+            // timeouts only know the address
+            net_peer peer(pid, p_.addr);
+            table->stale(peer);
+            bad(peer);
+        }, table->timeout(contact.id));
 }
 
 void node::store(bool origin, net_contact p, kv val, basic_callback ok, basic_callback bad) {
-    u32 chksum = util::crc32b((u8*)val.value.data());
+    u32 chksum = util::crc32c(val.value.data(), val.value.size());
     
     // hacky
     val.origin.id = id;
@@ -445,136 +485,170 @@ void node::store(bool origin, net_contact p, kv val, basic_callback ok, basic_ca
     net.send(true,
         p.addresses, proto::type::query, proto::actions::store,
         id, util::msg_id(), proto::store_query_data{ 
-            .k = dec(val.key), 
+            .k = val.key, 
             .d = val.type,
             .v = val.value, 
             .o = po,
             .t = val.timestamp,
             .s = origin ? crypto.sign(val.sig_blob()) : val.signature },
-        [this, ok, bad, chksum](net_peer p_, std::string s) { 
+        [this, ok, bad, chksum, val](net_peer p_, proto::response_data r) { 
             net_contact c = resolve_peer_in_table(p_);
+            const proto::store_resp_data* d = boost::get<proto::store_resp_data>(&r);
 
-            u32 csum;
-            std::stringstream ss;
-
-            ss << s;
-            ss >> csum;
+            // the response has been seen by now, so this is the schema it was sent under
+            u32 expect = net.schema(p_.addr) >= proto::crc32c_schema ? 
+                chksum : util::crc32b((u8*)val.value.data());
 
             // check if checksum is valid
-            if(csum == chksum)
+            if(d != nullptr && d->c == expect)
                 ok(c);
             else
                 bad(c);
         },
-        [this, bad](net_peer p_) {
-            table->stale(p_);
-            bad(p_);
-        });
+        [this, bad, pid = p.id](net_peer p_) {
+            net_peer peer(pid, p_.addr);
+            table->stale(peer);
+            bad(peer);
+        }, table->timeout(p.id));
 }
 
 void node::find_node(net_contact p, hash_t target_id, bucket_callback ok, basic_callback bad) {
     net.send(true,
         p.addresses, proto::type::query, proto::actions::find_node,
-        id, util::msg_id(), proto::find_query_data { .t = dec(target_id) },
-        [this, ok, bad](net_peer p_, std::string s) {
+        id, util::msg_id(), proto::find_query_data { 
+            .t = target_id, 
+            .m = crypto.session_has(session_to(p.id))
+        },
+        [this, ok, bad](net_peer p_, proto::response_data r) {
             net_contact c = resolve_peer_in_table(p_);
+            const proto::find_node_resp_data* b = boost::get<proto::find_node_resp_data>(&r);
 
-            msgpack::object_handle oh;
-            msgpack::unpack(oh, s.data(), s.size());
-            msgpack::object obj = oh.get();
-            proto::find_node_resp_data b;
-            obj.convert(b);
+            if(b == nullptr) {
+                bad(c);
+                return;
+            }
 
             std::list<net_contact> l;
 
-            for(auto i : b.b)
-                l.emplace_back(net_peer(enc(i.i), net_addr(i.t, i.a, i.p)));
-
-            // verify signature
-            std::stringstream ss;
-            {
-                std::vector<proto::peer_object> po;
-                for(auto i : l)
-                    po.push_back(proto::peer_object(net_peer{i.id, i.addresses.front()}));
-                msgpack::pack(ss, po);
-            }
+            for(const auto& i : b->b)
+                l.emplace_back(net_peer(i.i, net_addr(i.t, i.a, i.p)));
 
-            if(crypto.verify(c.id, ss.str(), b.s))
-                ok(c, std::move(l));
-            else
-                bad(c);
+            verify_bucket(c.id, net.schema(p_.addr) >= proto::binary_id_schema, *b, [ok, bad, c, l](bool v) {
+                if(v) ok(c, l);
+                else bad(c);
+            });
         },
-        [this, bad](net_peer p_) {
-            table->stale(p_);
-            bad(p_);
-        });
+        [this, bad, pid = p.id](net_peer p_) {
+            net_peer peer(pid, p_.addr);
+            table->stale(peer);
+            bad(peer);
+        }, table->timeout(p.id));
 }
 
 void node::find_value(net_contact p, hash_t target_id, find_value_callback ok, basic_callback bad) {
     net.send(true,
         p.addresses, proto::type::query, proto::actions::find_value,
-        id, util::msg_id(), proto::find_query_data { .t = dec(target_id) },
-        [this, ok, bad, target_id](net_peer p_, std::string s) {
+        id, util::msg_id(), proto::find_query_data { 
+            .t = target_id, 
+            .m = crypto.session_has(session_to(p.id))
+        },
+        [this, ok, bad, target_id](net_peer p_, proto::response_data r) {
             net_contact c = resolve_peer_in_table(p_);
+            const proto::find_value_resp_data* d = boost::get<proto::find_value_resp_data>(&r);
 
-            msgpack::object_handle oh;
-            msgpack::unpack(oh, s.data(), s.size());
-            msgpack::object obj = oh.get();
-            proto::find_value_resp_data d;
-            obj.convert(d);
+            if(d == nullptr) {
+                bad(c);
+                return;
+            }
 
-            if(!d.v.has_value() != !d.b.has_value()) {
-                if(d.v.has_value()) {
-                    proto::stored_data sd = d.v.value();
+            if(!d->v.has_value() != !d->b.has_value()) {
+                if(d->v.has_value()) {
+                    const proto::stored_data& sd = d->v.value();
                     ok(p_, kv(target_id, sd.d, sd.v, sd.o.to_peer(), sd.t, sd.s));
-                } else if(d.b.has_value()) {
+                } else if(d->b.has_value()) {
                     std::list<net_contact> l;
 
-                    for(auto i : d.b.value().b)
-                        l.emplace_back(net_peer(enc(i.i), net_addr(i.t, i.a, i.p)));
+                    for(const auto& i : d->b.value().b)
+                        l.emplace_back(net_peer(i.i, net_addr(i.t, i.a, i.p)));
 
-                    // verify signature
-                    std::stringstream ss;
-                    {
-                        std::vector<proto::peer_object> po;
-                        for(auto i : l)
-                            po.push_back(proto::peer_object(net_peer{i.id, i.addresses.front()}));
-
-                        msgpack::pack(ss, po);
-                    }
-
-                    if(crypto.verify(c.id, ss.str(), d.b.value().s))
-                        ok(c, std::move(l));
-                    else
-                        bad(c);
+                    verify_bucket(c.id, net.schema(p_.addr) >= proto::binary_id_schema, d->b.value(), 
+                        [ok, bad, c, l](bool v) {
+                        if(v) ok(c, l);
+                        else bad(c);
+                    });
                 }
             } else {
                 bad(c);
             }
         },
-        [this, bad](net_peer p_) {
-            table->stale(p_);
-            bad(p_);
-        });
+        [this, bad, pid = p.id](net_peer p_) {
+            net_peer peer(pid, p_.addr);
+            table->stale(peer);
+            bad(peer);
+        }, table->timeout(p.id));
 }
 
-void node::identify(net_contact contact, identify_callback ok, basic_callback bad) {
-    std::string token = util::gen_token(treng);
+/// @brief prove that `peer.addr` holds the key for `peer.id`. only that one address is checked,
+/// a handshake with another address of the same ID says nothing about this one.
+/// `session` offers an ephemeral key, the session is kept once the peer's signature checks out
+void node::identify(net_peer peer, identify_callback ok_, basic_callback bad_, bool session) {
+    std::string key = util::htob(peer.id) + "@" + peer.addr.to_string();
+
+    // queue behind a handshake already in flight with this peer instead of starting another
+    {
+        LOCK(idf_mutex);
+        auto it = identifying.find(key);
+
+        if(it != identifying.end()) {
+            it->second.emplace_back(ok_, bad_);
+            n_coalesced++;
+            return;
+        }
+
+        identifying[key].emplace_back(ok_, bad_);
+    }
+
+    // release everyone waiting on this peer together
+    identify_callback ok = [this, key](net_peer p_, std::string k) {
+        for(auto& w : identified(key))
+            w.first(p_, k);
+    };
+
+    basic_callback bad = [this, key](net_contact c) {
+        for(auto& w : identified(key))
+            w.second(c);
+    };
+
+    std::string token;
+
+    {
+        LOCK(treng_mutex);
+        token = util::gen_token(treng);
+    }
+
+    // offer an ephemeral key, the peer may answer with its own to agree on a session
+    std::shared_ptr<pki::crypto::ephemeral> eph;
+    if(constants::session_macs && session)
+        eph = std::make_shared<pki::crypto::ephemeral>(crypto.session_begin());
 
     net.send(true,
-        contact.addresses, proto::type::query, proto::actions::identify,
+        peer.addr, proto::type::query, proto::actions::identify,
         id, util::msg_id(), proto::identify_query_data {
-            .s = token
+            .s = token,
+            .e = eph ? boost::make_optional(eph->pub) : boost::none
         },
-        [this, ok, bad, token](net_peer p_, std::string s) {
-            msgpack::object_handle oh;
-            msgpack::unpack(oh, s.data(), s.size());
-            msgpack::object obj = oh.get();
-            proto::identify_resp_data d;
-            obj.convert(d);
+        [this, ok, bad, token, eph, peer](net_peer p_, proto::response_data r) {
+            const proto::identify_resp_data* rd = boost::get<proto::identify_resp_data>(&r);
+
+            if(rd == nullptr) {
+                bad(p_);
+                return;
+            }
+
+            const proto::identify_resp_data& d = *rd;
 
-            if(p_.id != util::hash(d.k)) {
-                // if peer id isn't hash(pkey), it's bad
+            if(p_.id != peer.id || p_.id != util::hash(d.k)) {
+                // if the address answers for another ID or the ID isn't hash(pkey), it's bad
                 bad(p_);
                 return;
             }
@@ -584,74 +658,187 @@ void node::identify(net_contact contact, identify_callback ok, basic_callback ba
 
             // verify if signature for token is correct
             std::string blob = fmt::format("{}:{}:{}", token, net.get_ip_address(), net.port);
-            if(crypto.verify(p_.id, blob, d.s)) {
-                ok(p_, d.k);
-            } else bad(p_);
+            boost::optional<std::string> e = eph ? d.e : boost::none;
+
+            // the signature then also covers both ephemeral keys
+            if(e)
+                blob += ":" + eph->pub + ":" + e.value();
+
+            crypto.async_verify(p_.id, std::move(blob), d.s, [this, ok, bad, p_, k = d.k, eph, e](bool v) {
+                if(!v) {
+                    bad(p_);
+                    return;
+                }
+
+                // only a responder that proved its key gets a session
+                if(e)
+                    crypto.session_put(session_to(p_.id), *eph, e.value());
+
+                ok(p_, k);
+            });
         },
-        [this, bad](net_peer p_) {
-            bad(p_);
-        });
+        [bad, peer](net_peer) {
+            bad(peer);
+        }, table->timeout(peer.id));
+}
+
+/// sessions
+
+/// @brief session we agreed on as the identifying side, used to check responses from the peer
+std::string node::session_to(hash_t pid) {
+    return "to:" + util::htob(pid);
+}
+
+/// @brief session the peer agreed on with us, used to MAC responses to it
+std::string node::session_from(net_peer p) {
+    return "from:" + util::htob(p.id) + "@" + p.addr.to_string();
+}
+
+/// @brief MAC the bucket if the querier holds a session with us, otherwise sign it on the crypto pool.
+/// it's covered with IDs encoded the way it's sent, binary if the querier reads them
+void node::sign_bucket(net_peer peer, bool mac, bool binary, std::vector<proto::peer_object> b, 
+    std::function<void(proto::find_node_resp_data)> cb) {
+    std::stringstream ss;
+
+    {
+        proto::binary_ids ids(binary);
+        msgpack::pack(ss, b);
+    }
+
+    std::string tag;
+    if(mac && !(tag = crypto.session_mac(session_from(peer), ss.str())).empty()) {
+        cb(proto::find_node_resp_data { .b = std::move(b), .s = "", .m = std::move(tag) });
+        return;
+    }
+
+    crypto.async_sign(ss.str(), [cb, b = std::move(b)](std::string sig) {
+        cb(proto::find_node_resp_data { .b = b, .s = std::move(sig) });
+    });
+}
+
+/// @brief check the MAC or signature over the bucket exactly as it was received.
+/// `binary` if the responder speaks binary IDs, it signed them that way then
+void node::verify_bucket(hash_t pid, bool binary, const proto::find_node_resp_data& b, std::function<void(bool)> cb) {
+    std::stringstream ss;
+
+    {
+        proto::binary_ids ids(binary);
+        msgpack::pack(ss, b.b);
+    }
+
+    if(b.m.has_value()) {
+        bool v = crypto.session_verify(session_to(pid), ss.str(), b.m.value());
+
+        // out of sync with the peer, go back to signatures until the next identify
+        if(!v)
+            crypto.session_del(session_to(pid));
+
+        cb(v);
+        return;
+    }
+
+    crypto.async_verify(pid, ss.str(), b.s, std::move(cb));
+}
+
+std::vector<node::identify_waiter> node::identified(const std::string& key) {
+    std::vector<identify_waiter> waiters;
+
+    LOCK(idf_mutex);
+    auto it = identifying.find(key);
+
+    if(it != identifying.end()) {
+        waiters = std::move(it->second);
+        identifying.erase(it);
+    }
+
+    return waiters;
 }
 
-std::future<net_peer> node::_verify_node(net_peer peer) {
-    std::shared_ptr<std::promise<net_peer>> prom = std::make_shared<std::promise<net_peer>>();
-    std::future<net_peer> fut = prom->get_future();
+u64 node::identify_coalesced() const {
+    return n_coalesced;
+}
 
-    identify(resolve_peer_in_table(peer),
-        [prom](net_peer p_, std::string) {
-            prom->set_value(p_);
+/// @brief `cb` gets the identified peer, or empty_net_peer if it didn't check out
+void node::_verify_node(net_peer peer, std::function<void(net_peer)> cb) {
+    identify(peer,
+        [cb](net_peer p_, std::string) {
+            cb(p_);
         },
-        [prom](net_contact) {
-            prom->set_value(empty_net_peer);
+        [cb](net_contact) {
+            cb(empty_net_peer);
         });
-
-    return fut;
 }
 
 void node::get_addresses(net_contact contact, hash_t target_id, addresses_callback ok, basic_callback bad) {
     net.send(true,
         contact.addresses, proto::type::query, proto::actions::get_addresses,
         id, util::msg_id(), proto::get_addresses_query_data{
-            .i = dec(target_id)
+            .i = target_id
         },
-        [this, ok, bad, target_id](net_peer peer, std::string s) {
+        [this, ok, bad, target_id](net_peer peer, proto::response_data r) {
             net_contact c = resolve_peer_in_table(peer);
+            const proto::get_addresses_resp_data* rd = boost::get<proto::get_addresses_resp_data>(&r);
 
-            msgpack::object_handle oh;
-            msgpack::unpack(oh, s.data(), s.size());
-            msgpack::object obj = oh.get();
-            proto::get_addresses_resp_data d;
-            obj.convert(d);
+            if(rd == nullptr) {
+                bad(c);
+                return;
+            }
 
-            std::vector<std::future<net_peer>> tasks;
-            std::list<net_peer> valid_peers;
+            const proto::get_addresses_resp_data& d = *rd;
 
+            std::vector<net_peer> candidates;
             net_addr our_addr("udp", net.get_ip_address(), net.port);
 
             for(auto a : d.p) {
                 try {
                     net_peer peer(target_id, net_addr(a.t, a.a, std::atoi(a.p.c_str())));
                     if(peer.addr == our_addr) continue;
-                    tasks.push_back(_verify_node(peer));
+                    candidates.push_back(peer);
                 } catch (std::exception&) { }
             }
 
-            for(auto&& t : tasks) {
-                net_peer p = t.get();
-
-                // if the address does in fact correspond to the ID, 
-                // "resolve" (find in table and add new address) then add to valid list
-                if(p != empty_net_peer) {
-                    valid_peers.push_back(p);
-                }
+            if(candidates.empty()) {
+                ok(c, {});
+                return;
             }
 
-            ok(c, valid_peers);
+            // this runs on the continuation pool, so don't wait on the identifies here.
+            // the last one to finish hands the list on
+            struct verifying {
+                std::mutex mutex;
+                std::list<net_peer> valid;
+                std::size_t remaining;
+            };
+
+            std::shared_ptr<verifying> st = std::make_shared<verifying>();
+            st->remaining = candidates.size();
+
+            for(const auto& peer : candidates) {
+                _verify_node(peer, [st, ok, c](net_peer p) {
+                    std::list<net_peer> valid;
+
+                    {
+                        LOCK(st->mutex);
+
+                        // if the address does in fact correspond to the ID, add to valid list
+                        if(p != empty_net_peer)
+                            st->valid.push_back(p);
+
+                        if(--st->remaining > 0)
+                            return;
+
+                        valid = std::move(st->valid);
+                    }
+
+                    ok(c, std::move(valid));
+                });
+            }
         },
-        [this, bad](net_peer p_) {
-            table->stale(p_);
-            bad(p_);
-        });
+        [this, bad, pid = contact.id](net_peer p_) {
+            net_peer peer(pid, p_.addr);
+            table->stale(peer);
+            bad(peer);
+        }, table->timeout(contact.id));
 }
 
 std::future<node::fut_t> node::_lookup(bool fv, net_contact p, hash_t target_id) {
@@ -685,7 +872,7 @@ std::list<net_contact> node::lookup_nodes(std::deque<net_contact> shortlist, has
 
     net_contact closest_node = *std::min_element(shortlist.begin(), shortlist.end(), 
         [target_id](net_contact a, net_contact b) { 
-            return (a.id ^ target_id) < (b.id ^ target_id); 
+            return hash_t::closer(a.id, b.id, target_id); 
         }
     ), candidate;
 
@@ -711,7 +898,7 @@ std::list<net_contact> node::lookup_nodes(std::deque<net_contact> shortlist, has
     };
 
     auto sort = [&](net_contact a, net_contact b) { 
-        return (a.id ^ target_id) < (b.id ^ target_id); 
+        return hash_t::closer(a.id, b.id, target_id); 
     };
 
     while(!shortlist.empty()) {
@@ -738,7 +925,7 @@ std::list<net_contact> node::lookup_nodes(std::deque<net_contact> shortlist, has
             if(v.type() != typeid(boost::blank) && !filter2(p))
                 res.push_back(p);
 
-            if(v.type() == typeid(std::list<net_peer>)) {
+            if(v.type() == typeid(std::list<net_contact>)) {
                 // The node then fills the shortlist with contacts from the replies received.
                 for(net_contact c : boost::get<std::list<net_contact>>(v)) {
                     if(!filter(c))
@@ -757,7 +944,7 @@ std::list<net_contact> node::lookup_nodes(std::deque<net_contact> shortlist, has
         std::sort(shortlist.begin(), shortlist.end(), sort);
         candidate = *std::min_element(res.begin(), res.end(), sort);
 
-        if((candidate.id ^ target_id) < (closest_node.id ^ target_id) || first) {
+        if(hash_t::closer(candidate.id, closest_node.id, target_id) || first) {
             closest_node = candidate;
             first = false;
         } else break;
@@ -977,68 +1164,49 @@ void node::republish(kv val) {
 }
 
 std::list<net_contact> node::iter_find_node(hash_t target_id) {
-    std::deque<routing_table_entry> a = table->find_alpha(target_id);
-    std::deque<net_contact> shortlist(a.size());
+    std::vector<net_contact> a = table->closest(target_id, proto::alpha);
 
     if(a.empty()) return {};
 
-    auto it = a.begin();
-    std::generate(shortlist.begin(), shortlist.end(), [&]() {
-        return net_contact(*(it++));
-    });
-
-    return lookup_nodes(shortlist, target_id);
+    return lookup_nodes(std::deque<net_contact>(a.begin(), a.end()), target_id);
 }
 
 // refreshing buckets will remove all alternate IP addresses from the table
-void node::refresh(tree* ptr) {
-    if(ptr == nullptr) return;
-    if(!ptr->leaf) return;
-    
+void node::refresh(bucket_range r) {
     hash_t randomness = util::gen_randomness(reng);
-    hash_t mask = ~hash_t(0) << (proto::bit_hash_width - ptr->prefix.cutoff);
-    hash_t random_id = ptr->prefix.prefix | (randomness & ~mask);
-    std::list<net_contact> bkt = iter_find_node(random_id);
-
-    if(!bkt.empty()) {
-        W_LOCK(table->mutex);
+    hash_t random_id = r.prefix | (randomness & ~hash_t::prefix_mask(r.cutoff));
+    std::list<net_contact> found = iter_find_node(random_id);
 
-        ptr->data.clear();
-        for(auto p : bkt) {
-            routing_table_entry e{ id, {} };
-            e.id = p.id;
-
-            for(auto a : p.addresses)
-                e.addresses.push_back(routing_table_entry::mi_addr{ a, 0 });
-
-            ptr->data.push_back(e);
-        }
-
-        spdlog::debug("dht: refreshed bucket {}, sz: {}", util::htos(ptr->prefix.prefix), ptr->data.size());
+    if(!found.empty()) {
+        std::size_t sz = table->replace(random_id, found);
+        spdlog::debug("dht: refreshed bucket {}, sz: {}", util::htos(r.prefix), sz);
     }
 }
 
 void node::join(net_addr a, basic_callback ok, basic_callback bad) {
     // add peer to routing table
-    ping(net_peer(0, a), [this, ok](net_contact c) {
-        // lookup our own id
-        std::list<net_contact> bkt = iter_find_node(id);
-
-        // populate routing table
-        // only add one address (?? for now)
-        for(auto i : bkt) {
-            table->update(net_peer{ i.id, i.addresses.front() });
-        }
+    ping(net_peer(hash_t(), a), [this, ok](net_contact c) {
+        // the lookups wait on continuations themselves, get off the pool first.
+        // `ok` runs there too so it may start lookups of its own
+        net.spawn([this, ok, c]() {
+            // lookup our own id
+            std::list<net_contact> bkt = iter_find_node(id);
+
+            // populate routing table
+            // only add one address (?? for now)
+            for(auto i : bkt) {
+                table->update(net_peer{ i.id, i.addresses.front() });
+            }
 
-        // it refreshes all buckets further away than its closest neighbor, 
-        // which will be in the occupied bucket with the lowest index.
-        table->dfs([&, this](tree* ptr) {
-            hash_t mask(~hash_t(0) << (proto::bit_hash_width - ptr->prefix.cutoff));
-            if((c.id & mask) != ptr->prefix.prefix)
-                refresh(ptr);
-        });
+            // it refreshes all buckets further away than its closest neighbor, 
+            // which will be in the occupied bucket with the lowest index.
+            for(const auto& r : table->ranges()) {
+                if((c.id & hash_t::prefix_mask(r.cutoff)) != r.prefix)
+                    refresh(r);
+            }
 
-        ok(c);
+            ok(c);
+        });
     }, bad);
 }
 
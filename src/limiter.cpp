@@ -0,0 +1,87 @@
+#include "limiter.h"
+
+namespace lotus {
+namespace dht {
+
+rate_limiter::rate_limiter(double pr, double pb, double gr, double gb) :
+    peer_rate(pr), peer_burst(pb), 
+    global_rate(gr), global_burst(gb),
+    global(gb),
+    n_admitted(0), n_dropped(0) { }
+
+void rate_limiter::configure(double pr, double pb, double gr, double gb) {
+    peer_rate = pr;
+    peer_burst = pb;
+    global_rate = gr;
+    global_burst = gb;
+}
+
+bool rate_limiter::allow(const std::string& peer) {
+    steady_clock::time_point now = steady_clock::now();
+    shard& s = shard_for(peer);
+
+    {
+        LOCK(s.mutex);
+
+        if(s.peers.size() >= constants::limiter_peers / shards.size())
+            sweep(s, now);
+
+        auto it = s.peers.emplace(peer, token_bucket(peer_burst)).first;
+        if(!it->second.take(peer_rate, peer_burst, now)) {
+            n_dropped++;
+            return false;
+        }
+    }
+
+    bool admitted;
+
+    {
+        LOCK(global_mutex);
+        admitted = global.take(global_rate, global_burst, now);
+    }
+
+    if(!admitted) {
+        // the message was dropped for everyone's sake, it shouldn't count against this peer too
+        LOCK(s.mutex);
+
+        auto it = s.peers.find(peer);
+        if(it != s.peers.end())
+            it->second.refund(peer_burst);
+
+        n_dropped++;
+        return false;
+    }
+
+    n_admitted++;
+    return true;
+}
+
+/// @brief forget peers whose bucket would have refilled by now, they behave like new ones anyway
+void rate_limiter::sweep(shard& s, steady_clock::time_point now) {
+    double refill = peer_burst / peer_rate;
+
+    for(auto it = s.peers.begin(); it != s.peers.end(); ) {
+        if(duration_cast<duration<double>>(now - it->second.last).count() >= refill)
+            it = s.peers.erase(it);
+        else
+            ++it;
+    }
+
+    // everyone is busy, start over rather than grow without bound
+    if(s.peers.size() >= constants::limiter_peers / shards.size())
+        s.peers.clear();
+}
+
+std::size_t rate_limiter::tracked() {
+    std::size_t n = 0;
+
+    for(auto& s : shards) {
+        LOCK(s.mutex);
+        n += s.peers.size();
+    }
+
+    return n;
+}
+
+}
+}
@@ -1,4 +1,5 @@
 #include "dht.h"
+#include <boost/multiprecision/cpp_int.hpp>
 
 int main(int argc, char** argv) {
     spdlog::set_level(spdlog::level::debug);
@@ -16,6 +17,7 @@ int main(int argc, char** argv) {
     case 2: // join
         {
             node n(true, std::atoi(argv[2]));
+            n.open_keystore("keystore2");
             n.run("pub2", "priv2");
             n.join(net_addr("udp", argv[3], std::atoi(argv[4])), 
                 [&](net_contact peer) {
@@ -32,6 +34,7 @@ int main(int argc, char** argv) {
     case 3: // join & resolve own ip
         {
             node n(true, std::atoi(argv[2]));
+            n.open_keystore("keystore");
             n.run("pub", "priv");
             n.join(net_addr("udp", argv[3], std::atoi(argv[4])), 
                 [&](net_contact peer) {
@@ -50,6 +53,232 @@ int main(int argc, char** argv) {
                 });
         }
         break;
+    case 4: // signature benchmark: sign/verify throughput per scheme
+        {
+            using clk = std::chrono::steady_clock;
+            int n = argc > 2 ? std::atoi(argv[2]) : 1000;
+            std::string message(256, 'x');
+
+            auto per_sec = [n](clk::duration d) {
+                return n / std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+            };
+
+            for(auto s : { lotus::pki::key_scheme::rsa, lotus::pki::key_scheme::ed25519 }) {
+                lotus::pki::crypto c;
+
+                auto t0 = clk::now();
+                c.generate_keypair(s);
+                auto t1 = clk::now();
+
+                std::string sig;
+                for(int i = 0; i < n; i++)
+                    sig = c.sign(message);
+                auto t2 = clk::now();
+
+                auto pk = lotus::pki::public_key::load(c.pub_key());
+                bool ok = true;
+                for(int i = 0; i < n; i++)
+                    ok = c.verify(*pk, message, sig) && ok;
+                auto t3 = clk::now();
+
+                spdlog::info("{}: keygen {} ms, sign {:.0f}/s, verify {:.0f}/s, sig {} bytes{}",
+                    s == lotus::pki::key_scheme::rsa ? "rsa-2048" : "ed25519",
+                    std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count(),
+                    per_sec(t2 - t1), per_sec(t3 - t2), sig.size(),
+                    ok ? "" : " (VERIFY FAILED)");
+            }
+        }
+        break;
+    case 5: // ID benchmark: node_id against the old boost::multiprecision ID
+        {
+            using clk = std::chrono::steady_clock;
+            using big_t = boost::multiprecision::number<
+                boost::multiprecision::cpp_int_backend<256, 256,
+                    boost::multiprecision::unsigned_magnitude, boost::multiprecision::unchecked, void>,
+                boost::multiprecision::et_off>;
+
+            int n = argc > 2 ? std::atoi(argv[2]) : 100000;
+            hash_reng_t reng(1);
+
+            std::vector<hash_t> ids(n);
+            std::vector<big_t> bigs(n);
+            for(int i = 0; i < n; i++) {
+                ids[i] = util::gen_randomness(reng);
+
+                lotus::u8 b[hash_t::bytes];
+                ids[i].to_bytes(b);
+                boost::multiprecision::import_bits(bigs[i], b, b + sizeof(b));
+            }
+
+            hash_t target = util::gen_randomness(reng);
+            big_t big_target = 0;
+            {
+                lotus::u8 b[hash_t::bytes];
+                target.to_bytes(b);
+                boost::multiprecision::import_bits(big_target, b, b + sizeof(b));
+            }
+
+            auto mops = [](clk::duration d, double ops) {
+                return ops / std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(d).count();
+            };
+
+            // sort by XOR distance, what lookup_nodes does
+            auto t0 = clk::now();
+            std::sort(ids.begin(), ids.end(), [&](const hash_t& a, const hash_t& b) {
+                return hash_t::closer(a, b, target);
+            });
+            auto t1 = clk::now();
+            std::sort(bigs.begin(), bigs.end(), [&](const big_t& a, const big_t& b) {
+                return (a ^ big_target) < (b ^ big_target);
+            });
+            auto t2 = clk::now();
+
+            // common prefix length, what bucket selection does
+            int sum = 0;
+            for(const auto& i : ids)
+                sum += (i ^ target).clz();
+            auto t3 = clk::now();
+            for(const auto& i : bigs) {
+                big_t d = i ^ big_target;
+                sum += d == 0 ? 256 : 255 - (int)boost::multiprecision::msb(d);
+            }
+            auto t4 = clk::now();
+
+            double cmps = n * std::log2(std::max(n, 2));
+            spdlog::info("sort by distance: node_id {:.1f} Mcmp/s, multiprecision {:.1f} Mcmp/s", 
+                mops(t1 - t0, cmps), mops(t2 - t1, cmps));
+            spdlog::info("xor + clz: node_id {:.1f} M/s, multiprecision {:.1f} M/s ({})", 
+                mops(t3 - t2, n), mops(t4 - t3, n), sum);
+        }
+        break;
+    case 6: // key hashing benchmark: util::hash against the old hex round trip
+        {
+            using clk = std::chrono::steady_clock;
+            using big_t = boost::multiprecision::number<
+                boost::multiprecision::cpp_int_backend<256, 256,
+                    boost::multiprecision::unsigned_magnitude, boost::multiprecision::unchecked, void>,
+                boost::multiprecision::et_off>;
+
+            int n = argc > 2 ? std::atoi(argv[2]) : 100000;
+
+            // what util::hash used to do: hex the digest into a stream and parse it back
+            auto old_hash = [](const std::string& s) {
+                std::stringstream ss;
+                ss << "0x";
+
+                CryptoPP::HexEncoder he(new CryptoPP::FileSink(ss));
+
+                std::string digest;
+                CryptoPP::SHA256 h;
+
+                h.Update((const CryptoPP::byte*)s.data(), s.size());
+                digest.resize(h.DigestSize() + 2);
+                h.Final((CryptoPP::byte*)&digest[2]);
+
+                (void)CryptoPP::StringSource(digest, true, new CryptoPP::Redirector(he));
+
+                return big_t(ss.str());
+            };
+
+            auto per_sec = [n](clk::duration d) {
+                return n / std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+            };
+
+            for(std::size_t len : { 32, 1024 }) {
+                std::string key(len, 'k');
+                lotus::u64 sink = 0;
+
+                auto t0 = clk::now();
+                for(int i = 0; i < n; i++) {
+                    key[0] = (char)i;
+                    sink += util::hash(key).w[0];
+                }
+                auto t1 = clk::now();
+                for(int i = 0; i < n; i++) {
+                    key[0] = (char)i;
+                    sink += old_hash(key).convert_to<lotus::u64>();
+                }
+                auto t2 = clk::now();
+
+                // large value in 64 byte pieces
+                util::hasher h;
+                for(int i = 0; i < n; i++) {
+                    for(std::size_t off = 0; off < len; off += 64)
+                        h.update(key.data() + off, std::min<std::size_t>(64, len - off));
+                    sink += h.final().w[0];
+                }
+                auto t3 = clk::now();
+
+                spdlog::info("{} byte keys: util::hash {:.0f}/s, hex round trip {:.0f}/s, incremental {:.0f}/s ({})",
+                    len, per_sec(t1 - t0), per_sec(t2 - t1), per_sec(t3 - t2), sink & 1);
+            }
+        }
+        break;
+    case 7: // routing table benchmark: XOR-trie against the flat bucket array
+        {
+            using clk = std::chrono::steady_clock;
+            int n = argc > 2 ? std::atoi(argv[2]) : 100000;
+            hash_reng_t reng(1);
+
+            spdlog::set_level(spdlog::level::info);
+
+            // never run, only there for the tables to hold on to
+            network net(true, argc > 3 ? std::atoi(argv[3]) : 16170, [](net_peer, proto::message) { });
+
+            hash_t self = util::gen_randomness(reng);
+
+            // half the peers share a growing prefix with us so the near buckets fill up too
+            std::vector<net_peer> peers;
+            for(int i = 0; i < n; i++) {
+                hash_t r = util::gen_randomness(reng);
+                if(i & 1) {
+                    hash_t mask = hash_t::prefix_mask(i % 64);
+                    r = (self & mask) | (r & ~mask);
+                }
+
+                peers.emplace_back(r, net_addr("udp", "127.0.0.1", 1024 + i % 60000));
+            }
+
+            std::vector<hash_t> targets(n);
+            for(auto& t : targets)
+                t = util::gen_randomness(reng);
+
+            auto per_sec = [n](clk::duration d) {
+                return n / std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+            };
+
+            auto run = [&](const char* name, std::shared_ptr<routing_table> table) {
+                table->init();
+
+                auto t0 = clk::now();
+                for(const auto& p : peers)
+                    table->update(p);
+                auto t1 = clk::now();
+
+                std::size_t found = 0;
+                for(const auto& p : peers)
+                    found += table->find(p.id).has_value();
+                auto t2 = clk::now();
+
+                std::size_t returned = 0;
+                for(const auto& t : targets)
+                    returned += table->closest(t, proto::alpha).size();
+                auto t3 = clk::now();
+                for(const auto& t : targets)
+                    returned += table->closest(t, proto::bucket_size).size();
+                auto t4 = clk::now();
+
+                std::size_t held = 0, buckets = 0;
+                table->each([&](bucket& b) { held += b.size(); buckets++; });
+
+                spdlog::info("{}: update {:.0f}/s, find {:.0f}/s, closest alpha {:.0f}/s, closest k {:.0f}/s ({} entries in {} buckets, {} found, {} returned)",
+                    name, per_sec(t1 - t0), per_sec(t2 - t1), per_sec(t3 - t2), per_sec(t4 - t3), held, buckets, found, returned);
+            };
+
+            run("trie", std::make_shared<trie_table>(self, net));
+            run("flat", std::make_shared<flat_table>(self, net));
+        }
+        break;
     }
 
     return 0;
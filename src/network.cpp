@@ -9,99 +9,230 @@ namespace dht {
 
 /// message queue
 
-void msg_queue::await(net_peer p, u64 msg_id, q_callback ok, f_callback bad) {
-    LOCK(mutex);
+msg_queue::msg_queue(boost::asio::io_context& ioc_) : 
+    ioc(ioc_), 
+    workers(proto::callback_threads),
+    count(0) { }
 
-    items.emplace_back(p, msg_id, false);
-    auto pit = items.end();
-
-    std::thread(&msg_queue::wait, this, --pit, ok, bad).detach();
+msg_queue::~msg_queue() {
+    workers.join();
 }
 
-void msg_queue::wait(std::list<item>::iterator it, q_callback ok, f_callback bad) {
-    try {
-        if(it == items.end()) {
-            bad(empty_net_peer);
-            return; // bad iterator
-        }
+void msg_queue::await(net_peer p, u64 msg_id, q_callback ok, f_callback bad, milliseconds timeout) {
+    std::shared_ptr<item> it = std::make_shared<item>(p, msg_id, ok, bad, ioc);
 
-        std::future<std::string> fut = it->promise.get_future();
-        std::future_status fs = fut.wait_for(seconds(proto::net_timeout));
-        
-        // since every action is one query-response we don't need to feed callback the message ID
-        net_peer req(empty_net_peer);
+    key k{ msg_id, p.addr };
+    shard& s = shard_for(k);
 
-        {
-            LOCK(mutex);
-            req = it->req;
-            it = items.erase(it);
+    {
+        LOCK(s.mutex);
+
+        // a response couldn't be told apart from the one already pending, fail this one
+        if(!s.items.emplace(k, it).second) {
+            reject(p, bad);
+            return;
         }
 
-        switch(fs) {
-        case std::future_status::ready:
-            ok(req, fut.get());
-            break;
+        count++;
+    }
 
-        case std::future_status::deferred:
-        case std::future_status::timeout:
-            bad(req);
-            break;
-        }
+    // armed only once it's in the map so expire always finds it. timers aren't
+    // thread-safe, arm from the io_context like satisfy does
+    boost::asio::post(ioc, [this, it, timeout]() {
+        if(it->satisfied)
+            return;
 
-    } catch (std::future_error& e) {
-        bad(it->req);
-        
-        {
-            LOCK(mutex);
-            items.erase(it);
+        it->timer.expires_after(timeout);
+        it->timer.async_wait([this, it](boost::system::error_code ec) {
+            // cancelled by satisfy
+            if(ec == boost::asio::error::operation_aborted)
+                return;
+
+            expire(it);
+        });
+    });
+}
+
+void msg_queue::expire(std::shared_ptr<item> it) {
+    key k{ it->msg_id, it->req.addr };
+    shard& s = shard_for(k);
+
+    {
+        LOCK(s.mutex);
+
+        // satisfy got to it first
+        if(it->satisfied)
+            return;
+
+        it->satisfied = true;
+
+        auto i = s.items.find(k);
+        if(i != s.items.end() && i->second == it) {
+            s.items.erase(i);
+            count--;
         }
     }
+
+    boost::asio::post(workers, [it]() { it->bad(it->req); });
 }
 
-void msg_queue::satisfy(net_peer p, u64 msg_id, std::string data) {
-    LOCK(mutex);
+void msg_queue::satisfy(net_peer p, u64 msg_id, proto::response_data data) {
+    std::shared_ptr<item> it;
+    key k{ msg_id, p.addr };
+    shard& s = shard_for(k);
 
-    auto it = std::find_if(items.begin(), items.end(),
-        [&](const item& i) { 
-            return (i.req.id == p.id || 
-                i.req.addr == p.addr) && 
-                i.msg_id == msg_id && 
-                !i.satisfied; 
-        });
+    {
+        LOCK(s.mutex);
 
-    if(it == items.end())
-        return;
+        auto i = s.items.find(k);
+        if(i == s.items.end() || i->second->satisfied)
+            return;
+
+        it = i->second;
+        it->satisfied = true;
+        s.items.erase(i);
+        count--;
+    }
+
+    // timers aren't thread-safe, cancel from the io_context
+    boost::asio::post(ioc, [it]() { it->timer.cancel(); });
+
+    on_rtt(p, duration_cast<milliseconds>(steady_clock::now() - it->sent));
+
+    // since every action is one query-response we don't need to feed callback the message ID.
+    // hand back the responder's full identity instead of what we sent to
+    boost::asio::post(workers, [it, p, data = std::move(data)]() { it->ok(p, data); });
+}
+
+/// @brief stop waiting on an RPC without calling either callback
+void msg_queue::cancel(net_addr addr, u64 msg_id) {
+    std::shared_ptr<item> it;
+    key k{ msg_id, addr };
+    shard& s = shard_for(k);
+
+    {
+        LOCK(s.mutex);
+
+        auto i = s.items.find(k);
+        if(i == s.items.end() || i->second->satisfied)
+            return;
+
+        it = i->second;
+        it->satisfied = true;
+        s.items.erase(i);
+        count--;
+    }
+
+    boost::asio::post(ioc, [it]() { it->timer.cancel(); });
+}
+
+/// @brief fail an RPC that was never sent
+void msg_queue::reject(net_peer p, f_callback bad) {
+    boost::asio::post(workers, [p, bad]() { bad(p); });
+}
 
-    it->satisfied = true;
-    it->req = p;
-    it->promise.set_value(data);
+void msg_queue::post(std::function<void()> f) {
+    boost::asio::post(workers, std::move(f));
 }
 
 bool msg_queue::pending(net_peer p, u64 msg_id) {
-    LOCK(mutex);
+    key k{ msg_id, p.addr };
+    shard& s = shard_for(k);
 
-    auto it = std::find_if(items.begin(), items.end(),
-        [&](const item& i) { 
-            return i.req.addr == p.addr && 
-                i.msg_id == msg_id && 
-                !i.satisfied;  
-        });
+    LOCK(s.mutex);
 
-    return it != items.end();
+    auto i = s.items.find(k);
+    return i != s.items.end() && !i->second->satisfied;
 }
 
 /// networking
 
-network::network(bool local_, u16 p, h_callback handler) :
-    local(local_),
+#ifdef SO_REUSEPORT
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+network::lane::lane(u16 p, bool shared, slab_pool& pool) : socket(ioc) {
+    socket.open(udp::v4());
+
+    if(shared) {
+#ifdef SO_REUSEPORT
+        socket.set_option(reuse_port(true));
+#else
+        throw std::runtime_error("SO_REUSEPORT is not supported on this platform");
+#endif
+    }
+
+    socket.bind(udp::endpoint(udp::v4(), p));
+
+#ifdef __linux__
+    rx.resize(constants::batch_size);
+    rx_hdrs.resize(constants::batch_size);
+    rx_iov.resize(constants::batch_size);
+    rx_addrs.resize(constants::batch_size);
+
+    for(int i = 0; i < constants::batch_size; i++) {
+        rx[i] = pool.acquire();
+        rx_iov[i].iov_base = rx[i]->data;
+        rx_iov[i].iov_len = proto::max_data_size;
+
+        std::memset(&rx_hdrs[i], 0, sizeof(mmsghdr));
+        rx_hdrs[i].msg_hdr.msg_iov = &rx_iov[i];
+        rx_hdrs[i].msg_hdr.msg_iovlen = 1;
+        rx_hdrs[i].msg_hdr.msg_name = &rx_addrs[i];
+    }
+#endif
+}
+
+network::network(bool local_, u16 p, h_callback handler, std::size_t threads) :
+    slabs(constants::receive_slabs),
+    send_buffers(constants::send_buffers),
+    queue(ioc),
+    inbound(constants::inbound_peer_rate, constants::inbound_peer_burst, 
+        constants::inbound_global_rate, constants::inbound_global_burst),
+    outbound(constants::outbound_peer_rate, constants::outbound_peer_burst, 
+        constants::outbound_global_rate, constants::outbound_global_burst),
     port(p),
-    socket(ioc, udp::endpoint(udp::v4(), p)),
-    upnp_(false), // TODO: consider ipv6 addition?
-    message_handler(handler) { }
+    local(local_),
+    batch(constants::batch_io),
+    race(constants::race_addresses),
+    message_handler(handler),
+    work(boost::asio::make_work_guard(ioc)),
+    stopping(false),
+    next_lane(0),
+    upnp_(false) { // TODO: consider ipv6 addition?
+    if(threads == 0)
+        threads = 1;
+
+    // every lane binds the same port, the kernel spreads datagrams across them
+    for(std::size_t i = 0; i < threads; i++)
+        lanes.emplace_back(new lane(p, threads > 1, slabs));
+}
 
 network::~network() {
+    {
+        LOCK(release_mutex);
+        stopping = true;
+    }
+
+    release_cv.notify_all();
+
+    // the work guard keeps the timer context alive with nothing queued, so it has to be stopped
+    work.reset();
+    ioc.stop();
+
+    // receives rearm forever, stop each lane's context and close its socket once its thread is out
+    for(auto& ln : lanes)
+        ln->ioc.stop();
+
     if(release_thread.joinable()) release_thread.join();
     if(ioc_thread.joinable()) ioc_thread.join();
+
+    for(auto& ln : lanes) {
+        if(ln->thread.joinable()) ln->thread.join();
+
+        boost::system::error_code ec;
+        ln->socket.close(ec);
+    }
 }
 
 void network::run() {
@@ -111,55 +242,215 @@ void network::run() {
                 spdlog::error("upnp: failed to re-lease port mapping");
             }
 
-            std::this_thread::sleep_for(seconds(constants::upnp_release_interval));
+            std::unique_lock<std::mutex> l(release_mutex);
+            if(release_cv.wait_for(l, seconds(constants::upnp_release_interval), [this]() { return stopping; }))
+                break;
         }
     });
 
-    recv();
+    // timers run on their own context
     ioc_thread = std::thread([&, this]() { ioc.run(); });
+
+    for(auto& ln : lanes) {
+        recv(*ln);
+        ln->thread = std::thread([this, ptr = ln.get()]() { ptr->ioc.run(); });
+    }
 }
 
-void network::recv() {
-    socket.async_wait(udp::socket::wait_read,
-        [this](boost::system::error_code ec) {
+void network::recv(lane& ln) {
+    ln.socket.async_wait(udp::socket::wait_read,
+        [this, &ln](boost::system::error_code ec) {
             if(ec) goto bad;
 
+#ifdef __linux__
+            if(batch) {
+                recv_batch(ln);
+                goto bad;
+            }
+#endif
+
             {
                 udp::socket::bytes_readable readable(true);
-                socket.io_control(readable, ec);
+                ln.socket.io_control(readable, ec);
 
                 if(!ec) {
-                    std::string buf;
                     auto len = readable.get();
 
                     // messages larger than the maximum allowed size will be discarded
                     if(len > proto::max_data_size || len == 0)
                         goto bad;
 
-                    buf.resize(len);
-
-                    socket.receive_from(boost::asio::buffer(buf), endpoint, 0, ec);
+                    slab_ref buf = slabs.acquire();
+                    buf->size = ln.socket.receive_from(boost::asio::buffer(buf->data, len), ln.endpoint, 0, ec);
 
                     if(!ec) {
-                        handle(std::move(buf), endpoint);
+                        handle(std::move(buf), ln.endpoint);
                     }
                 }
             }
 
-            bad: recv();
+            bad: recv(ln);
         });
 }
 
-void network::handle(std::string buf, udp::endpoint ep) {
+void network::transmit(send_ref buf, udp::endpoint ep) {
+    lane& ln = *lanes[next_lane++ % lanes.size()];
+
+#ifdef __linux__
+    if(batch) {
+        bool idle;
+
+        {
+            LOCK(ln.tx_mutex);
+            idle = ln.tx.empty();
+            ln.tx.emplace_back(std::move(buf), ep);
+        }
+
+        // whoever queues first schedules the flush, later sends ride along
+        if(idle)
+            boost::asio::post(ln.ioc, [this, &ln]() { flush(ln); });
+
+        return;
+    }
+#endif
+
+    // sockets aren't thread-safe, send from the lane's own thread.
+    // the buffer goes back to the pool once the send completes
+    boost::asio::post(ln.ioc, [&ln, buf, ep]() {
+        ln.socket.async_send_to(
+            boost::asio::buffer(buf->sb.data(), buf->sb.size()), ep,
+            [buf](boost::system::error_code, std::size_t) { });
+    });
+}
+
+#ifdef __linux__
+/// @brief drain up to batch_size datagrams in one syscall
+void network::recv_batch(lane& ln) {
+    for(auto& h : ln.rx_hdrs) {
+        h.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        h.msg_hdr.msg_flags = 0;
+    }
+
+    int n = recvmmsg(ln.socket.native_handle(), ln.rx_hdrs.data(), ln.rx_hdrs.size(), MSG_DONTWAIT, nullptr);
+
+    for(int i = 0; i < n; i++) {
+        const mmsghdr& h = ln.rx_hdrs[i];
+
+        // messages larger than the maximum allowed size will be discarded
+        if(h.msg_len == 0 || (h.msg_hdr.msg_flags & MSG_TRUNC))
+            continue;
+
+        udp::endpoint ep;
+        std::memcpy(ep.data(), h.msg_hdr.msg_name, h.msg_hdr.msg_namelen);
+        ep.resize(h.msg_hdr.msg_namelen);
+
+        // hand the filled slab over and put a fresh one in its slot
+        slab_ref buf = std::move(ln.rx[i]);
+        buf->size = h.msg_len;
+
+        ln.rx[i] = slabs.acquire();
+        ln.rx_iov[i].iov_base = ln.rx[i]->data;
+
+        handle(std::move(buf), ep);
+    }
+}
+
+/// @brief send everything queued on a lane with sendmmsg
+void network::flush(lane& ln) {
+    std::vector<std::pair<send_ref, udp::endpoint>> out;
+
+    {
+        LOCK(ln.tx_mutex);
+        out.swap(ln.tx);
+    }
+
+    std::array<mmsghdr, constants::batch_size> hdrs;
+    std::array<iovec, constants::batch_size> iov;
+
+    for(std::size_t sent = 0; sent < out.size(); ) {
+        std::size_t n = std::min(out.size() - sent, std::size_t(constants::batch_size));
+
+        for(std::size_t i = 0; i < n; i++) {
+            auto& o = out[sent + i];
+
+            iov[i].iov_base = const_cast<char*>(o.first->sb.data());
+            iov[i].iov_len = o.first->sb.size();
+
+            std::memset(&hdrs[i], 0, sizeof(mmsghdr));
+            hdrs[i].msg_hdr.msg_iov = &iov[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+            hdrs[i].msg_hdr.msg_name = o.second.data();
+            hdrs[i].msg_hdr.msg_namelen = o.second.size();
+        }
+
+        int r = sendmmsg(ln.socket.native_handle(), hdrs.data(), n, MSG_DONTWAIT);
+
+        if(r <= 0) {
+            // socket buffer is full, let asio finish the rest
+            for(; sent < out.size(); sent++) {
+                send_ref buf = out[sent].first;
+                ln.socket.async_send_to(
+                    boost::asio::buffer(buf->sb.data(), buf->sb.size()), out[sent].second,
+                    [buf](boost::system::error_code, std::size_t) { });
+            }
+
+            break;
+        }
+
+        sent += r;
+    }
+}
+#endif
+
+// strings and binaries point into the slab instead of being copied into the zone
+static bool reference_slab(msgpack::type::object_type, std::size_t, void*) {
+    return true;
+}
+
+int network::schema(const net_addr& a) {
+    schema_key k(a.addr, a.port);
+    schema_shard& s = schemas[schema_hash()(k) % schemas.size()];
+
+    LOCK(s.mutex);
+    auto it = s.peers.find(k);
+    return it != s.peers.end() ? it->second : 0;
+}
+
+void network::saw_schema(const net_addr& a, int v) {
+    schema_key k(a.addr, a.port);
+    schema_shard& s = schemas[schema_hash()(k) % schemas.size()];
+
+    LOCK(s.mutex);
+    auto it = s.peers.find(k);
+    if(it != s.peers.end()) {
+        it->second = v;
+        return;
+    }
+
+    // forgetting only costs falling back to base58 until the peer speaks again
+    if(s.peers.size() >= (std::size_t)constants::schema_peers / schemas.size())
+        s.peers.clear();
+
+    s.peers.emplace(std::move(k), v);
+}
+
+void network::handle(slab_ref buf, udp::endpoint ep) {
     try {
-        msgpack::object_handle result;
+        std::size_t off = 0;
+        bool referenced = false;
+
+        msgpack::object obj = msgpack::unpack(buf->zone, buf->data, buf->size, off, referenced, reference_slab);
 
-        msgpack::unpack(result, buf.c_str(), buf.size());
-        msgpack::object obj(result.get());
+        proto::message msg;
+        obj.convert(msg);
+        msg.buf = std::move(buf);
 
-        proto::message msg = obj.as<proto::message>();
+        // shed new queries when a peer or the node as a whole is over its budget
+        if(msg.m == proto::type::query && !inbound.allow(ep.address().to_string()))
+            return;
 
-        net_peer p{ enc(msg.i), net_addr("udp", ep.address().to_string(), ep.port()) };
+        net_peer p{ msg.i, net_addr("udp", ep.address().to_string(), ep.port()) };
+        saw_schema(p.addr, msg.s);
 
         // if there's already a response pending, drop this one
         // except if it's an identify request
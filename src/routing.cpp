@@ -3,28 +3,136 @@
 #include "network.h"
 #include "util.hpp"
 
-/// @private
-/// @brief internal macro that traverses a tree based on the peer's id and also
-/// tries to find peer within current bucket after traversal
-#define TRAVERSE(I) \
-    tree* ptr = NULL; \
-    bucket::iterator it; \
-    int cutoff = 0; \
-    { \
-        R_LOCK(mutex); \
-        ptr = root; \
-        traverse(false, I, &ptr, cutoff); \
-        assert(ptr != nullptr); \
-        it = std::find_if(ptr->data.begin(), ptr->data.end(), \
-            [&](const routing_table_entry& e) { return e.id == I; }); \
-    }
-
 namespace lotus {
 namespace dht {
 
+routing_table::routing_table(hash_t id_, network& net_) : id(id_), net(net_) { };
+routing_table::~routing_table() { }
+
+void routing_table::init() {
+    strong_ref = shared_from_this();
+}
+
+void routing_table::stale(net_peer req) {
+    W_LOCK(mutex);
+    locate(req.id).stale(req);
+}
+
+void routing_table::responded(net_peer req) {
+    W_LOCK(mutex);
+    locate(req.id).responded(req);
+}
+
+std::vector<bucket_range> routing_table::ranges() {
+    std::vector<bucket_range> r;
+
+    each([&](bucket& b) {
+        r.push_back(bucket_range{ b.prefix, b.cutoff, b.last_seen });
+    });
+
+    return r;
+}
+
+/// @brief refreshes look the bucket up again here, it may have split since its range was taken
+std::size_t routing_table::replace(const hash_t& t, const std::list<net_contact>& found) {
+    W_LOCK(mutex);
+
+    bucket& b = locate(t);
+    hash_t mask = hash_t::prefix_mask(b.cutoff);
+
+    b.clear();
+    for(const auto& p : found) {
+        // the lookup returns whatever is closest, only keep what belongs in this bucket
+        if((p.id & mask) != b.prefix || b.size() >= b.max_size)
+            continue;
+
+        if(p.addresses.empty())
+            continue;
+
+        routing_table_entry e{ p.id, p.addresses.front() };
+
+        for(std::size_t a = 1; a < p.addresses.size(); a++)
+            e.addresses.push_back(routing_table_entry::mi_addr{ p.addresses[a], 0 });
+
+        b.insert(e);
+    }
+
+    return b.size();
+}
+
+bucket& routing_table::find_bucket(hash_t req) {
+    R_LOCK(mutex);
+    return locate(req);
+}
+
+boost::optional<routing_table_entry> routing_table::find(hash_t id) {
+    R_LOCK(mutex);
+
+    bucket& b = locate(id);
+    int i = b.find(id);
+
+    return (i >= 0) ? b.entry(i) : boost::optional<routing_table_entry>(boost::none);
+}
+
+/// @brief record a response. the answering address is cleared of misses so it's tried first next time
+void routing_table::rtt_sample(net_peer p, milliseconds r) {
+    W_LOCK(mutex);
+    locate(p.id).sample(p, r);
+}
+
+/// @brief adaptive timeout for an RPC to this peer
+milliseconds routing_table::timeout(hash_t id) {
+    R_LOCK(mutex);
+
+    bucket& b = locate(id);
+    int i = b.find(id);
+
+    return (i >= 0) ? b.rtt(i).rto : milliseconds(proto::rtt_initial);
+}
+
+boost::optional<rtt_estimator> routing_table::rtt(hash_t id) {
+    R_LOCK(mutex);
+
+    bucket& b = locate(id);
+    int i = b.find(id);
+
+    return (i >= 0) ? b.rtt(i) : boost::optional<rtt_estimator>(boost::none);
+}
+
+/// @brief per-thread candidate buffer, so queries don't allocate once it has grown
+std::vector<routing_table::candidate>& routing_table::scratch() {
+    thread_local std::vector<candidate> c;
+    c.clear();
+    return c;
+}
+
+void routing_table::gather(const bucket& b, const hash_t& t, std::vector<candidate>& c) {
+    for(std::size_t i = 0; i < b.size(); i++)
+        if(b.live(i))
+            c.push_back(candidate{ b.id(i) ^ t, &b, static_cast<int>(i) });
+}
+
+/// @brief sort the nearest `n` candidates and copy only those out
+std::vector<net_contact> routing_table::pick(std::vector<candidate>& c, std::size_t n) {
+    n = std::min(n, c.size());
+
+    std::partial_sort(c.begin(), c.begin() + n, c.end(), 
+        [](const candidate& a, const candidate& b) { return a.d < b.d; });
+
+    std::vector<net_contact> res;
+    res.reserve(n);
+
+    for(std::size_t i = 0; i < n; i++)
+        res.push_back(c[i].b->contact(c[i].i));
+
+    return res;
+}
+
+/// trie
+
 /// @brief initialize a tree
 tree::tree(std::shared_ptr<routing_table> rt) :
-    data(rt), leaf(true), left(nullptr), right(nullptr) { }
+    left(nullptr), right(nullptr), data(rt), leaf(true) { }
 
 tree::~tree() {
     delete left; left = nullptr;
@@ -32,27 +140,27 @@ tree::~tree() {
 }
 
 // routing table is a XOR-trie
-routing_table::routing_table(hash_t id_, network& net_) : id(id_), net(net_) { };
-routing_table::~routing_table() { delete root; root = nullptr; }
+trie_table::trie_table(hash_t id_, network& net_) : routing_table(id_, net_), root(nullptr) { };
+trie_table::~trie_table() { delete root; root = nullptr; }
 
-void routing_table::init() {
-    strong_ref = shared_from_this();
+void trie_table::init() {
+    routing_table::init();
 
     W_LOCK(mutex);
 
     root = new tree(shared_from_this());
     root->parent = nullptr;
-    root->prefix.prefix = hash_t(0);
-    root->prefix.cutoff = 0;
+    root->data.prefix = hash_t();
+    root->data.cutoff = 0;
 }
 
 /// @brief take a ptr to the ptr of some root and traverse based on bits of id
-void routing_table::traverse(bool p, hash_t t, tree** ptr, int& cutoff) {
+void trie_table::traverse(bool p, hash_t t, tree** ptr, int& cutoff) {
     if(!ptr) return;
     if(!*ptr) return;
 
     while((*(*ptr)).leaf == false) {
-        if(t & (1 << (proto::bit_hash_width - cutoff++))) {
+        if(t.bit(cutoff++)) {
             if(!(*(*ptr)).right) { *ptr = NULL; return; }
             else if(p && (*ptr)->right->leaf) return;
             *ptr = (*ptr)->right;
@@ -65,130 +173,200 @@ void routing_table::traverse(bool p, hash_t t, tree** ptr, int& cutoff) {
 }
 
 /// @brief split a tree ptr into two subtrees, categorize contained nodes into new subtrees
-void routing_table::split(tree* t, int cutoff) {
+void trie_table::split(tree* t, int cutoff) {
     if(!t) return;
 
     t->left = new tree(shared_from_this());
     if(!t->left) return;
     t->left->parent = t;
-    t->left->prefix.prefix = t->prefix.prefix;
-    t->left->prefix.cutoff = cutoff + 1;
+    t->left->data.prefix = t->data.prefix;
+    t->left->data.cutoff = cutoff + 1;
 
     t->right = new tree(shared_from_this());
     if(!t->right) return;
     t->right->parent = t;
-    t->right->prefix.prefix = t->prefix.prefix | (hash_t(1) << (proto::bit_hash_width - cutoff));
-    t->right->prefix.cutoff = cutoff + 1;
+    t->right->data.prefix = hash_t(t->data.prefix).set(cutoff);
+    t->right->data.cutoff = cutoff + 1;
 
     t->leaf = false;
 
-    for(auto& it : t->data) {
-        if(it.id & (1 << (proto::bit_hash_width - cutoff))) {
-            t->right->data.push_back(it);
-        } else { 
-            t->left->data.push_back(it);
+    for(std::size_t i = 0; i < t->data.size(); i++) {
+        if(t->data.id(i).bit(cutoff)) {
+            t->right->data.insert(t->data.entry(i));
+        } else {
+            t->left->data.insert(t->data.entry(i));
         }
     }
 
     t->data.clear();
 }
 
-/// @brief update peer in routing table whether or not it exists within table
-void routing_table::update(net_peer req) {
-    TRAVERSE(req.id);
+bucket& trie_table::locate(const hash_t& t) {
+    tree* ptr = root;
+    int cutoff = 0;
+
+    traverse(false, t, &ptr, cutoff);
+    assert(ptr != nullptr);
 
+    return ptr->data;
+}
+
+/// @brief update peer in routing table whether or not it exists within table
+void trie_table::update(net_peer req) {
     W_LOCK(mutex);
 
-    hash_t mask(~hash_t(0) << (proto::bit_hash_width - cutoff));
+    tree* ptr = root;
+    int cutoff = 0;
+    traverse(false, req.id, &ptr, cutoff);
+    assert(ptr != nullptr);
+
+    hash_t mask = hash_t::prefix_mask(cutoff);
+
+    if(ptr->data.find(req.id) >= 0) {
+        if((req.id & mask) == (id & mask)) {
+            // bucket is full but nearby, update node
+            ptr->data.update_near_entry(req);
+        } else {
+            // node is known to us already but far so ping to check liveness
+            ptr->data.update_far_entry(req);
+        }
+
+        return;
+    }
+
+    // bucket is full and within our own prefix, split until there's room
+    /// @todo relaxed splitting, see https://stackoverflow.com/questions/32129978/highly-unbalanced-kademlia-routing-table/32187456#32187456
+    while(ptr->data.size() >= ptr->data.max_size && cutoff < hash_t::bits &&
+        (req.id & mask) == (id & mask)) {
+        spdlog::debug("routing: bucket is within prefix, split");
+
+        split(ptr, cutoff);
+        traverse(false, req.id, &ptr, cutoff);
+        mask = hash_t::prefix_mask(cutoff);
+    }
 
-    if(it == ptr->data.end() && ptr->data.size() < ptr->data.max_size) {
+    if(ptr->data.size() < ptr->data.max_size) {
         // bucket is not full and peer doesnt exist yet, add to bucket
         ptr->data.add_new(req);
     } else {
-        if(it != ptr->data.end()) {
-            if((req.id & mask) == (id & mask)) {
-                if(it == ptr->data.end()) {
-                    spdlog::debug("routing: bucket is within prefix, split");
-                    // bucket is full and within our own prefix, split
-                    /// @todo relaxed splitting, see https://stackoverflow.com/questions/32129978/highly-unbalanced-kademlia-routing-table/32187456#32187456
-                    split(ptr, cutoff);
-                } else {
-                    // bucket is full but nearby, update node
-                    ptr->data.update_near_entry(req);
-                }
-            } else {
-                if(it != ptr->data.end()) {
-                    // node is known to us already but far so ping to check liveness
-                    ptr->data.update_far_entry(req);
-                } else {
-                    // add/update entry in replacement cache
-                    ptr->data.update_cache(req);
-                }
-            }
-        }
+        // add/update entry in replacement cache
+        ptr->data.update_cache(req);
     }
 }
 
-void routing_table::stale(net_peer req) {
-    TRAVERSE(req.id);
-    ptr->data.stale(req);
+void trie_table::_dfs(std::function<void(bucket&)> fn, tree* ptr) {
+    if(ptr == nullptr)
+        return;
+
+    if(ptr->leaf) {
+        if(!ptr->data.empty())
+            fn(ptr->data);
+        return;
+    }
+
+    _dfs(fn, ptr->left);
+    _dfs(fn, ptr->right);
 }
 
-bucket& routing_table::find_bucket(hash_t req) {
-    TRAVERSE(req);
-    return ptr->data;
+void trie_table::each(std::function<void(bucket&)> fn) {
+    R_LOCK(mutex);
+    _dfs(fn, root);
 }
 
-void routing_table::_dfs(std::function<void(tree*)> fn, tree* ptr) {
-    if(ptr == nullptr) 
+/// @brief visit subtrees nearest the target first. the child on the target's side of a split
+/// holds everything nearer than the other one, so that one is only needed if we're still short
+void trie_table::walk(tree* ptr, int depth, const hash_t& t, std::size_t n, std::vector<candidate>& c) {
+    if(ptr == nullptr)
         return;
 
-    R_LOCK(mutex);
-
-    if(ptr->leaf && ptr->data.empty()) 
+    if(ptr->leaf) {
+        gather(ptr->data, t, c);
         return;
+    }
 
-    fn(ptr);
+    bool right = t.bit(depth);
+    walk(right ? ptr->right : ptr->left, depth + 1, t, n, c);
 
-    if(ptr->left) _dfs(fn, ptr->left);
-    if(ptr->right) _dfs(fn, ptr->right);
+    if(c.size() < n)
+        walk(right ? ptr->left : ptr->right, depth + 1, t, n, c);
 }
 
-void routing_table::dfs(std::function<void(tree*)> fn) {
-    tree* ptr = root;
-    _dfs(fn, ptr);
+std::vector<net_contact> trie_table::closest(const hash_t& t, std::size_t n) {
+    R_LOCK(mutex);
+
+    std::vector<candidate>& c = scratch();
+    walk(root, 0, t, n, c);
+
+    return pick(c, n);
 }
 
-std::deque<routing_table_entry> routing_table::find_alpha(hash_t req) {
-    R_LOCK(mutex);
+/// flat
 
-    TRAVERSE(req);
+flat_table::flat_table(hash_t id_, network& net_) : routing_table(id_, net_), buckets(new bucket[hash_t::bits]) { };
 
-    std::deque<routing_table_entry> res;
+void flat_table::init() {
+    routing_table::init();
 
-    int n = 0;
-    for(auto e = ptr->data.begin(); e != ptr->data.end() && n++ < proto::alpha; ++e)
-        res.push_back(*e);
+    W_LOCK(mutex);
 
-    // try and get more contacts from sibling tree nodes if there aren't enough 
-    if(res.size() < proto::alpha && ptr->parent != nullptr) {
-        ptr = ptr->parent->left == ptr ? ptr->parent->right : ptr->parent->left;
-        std::copy_n(ptr->data.begin(), proto::alpha - res.size(), std::back_inserter(res));
+    // bucket i holds IDs sharing our first i bits and differing at bit i
+    for(int i = 0; i < hash_t::bits; i++) {
+        buckets[i].table = shared_from_this();
+        buckets[i].prefix = (id & hash_t::prefix_mask(i + 1)) ^ hash_t().set(i);
+        buckets[i].cutoff = i + 1;
     }
+}
 
-    // nothing we can do afterwards
-    return res;
+bucket& flat_table::locate(const hash_t& t) {
+    return buckets[index(t)];
 }
 
-boost::optional<routing_table_entry> routing_table::find(hash_t id) {
-    R_LOCK(mutex);
+void flat_table::update(net_peer req) {
+    if(req.id == id)
+        return;
 
-    TRAVERSE(id);
-    
-    return (it != ptr->data.end()) ? *it : boost::optional<routing_table_entry>(boost::none);
+    W_LOCK(mutex);
+
+    bucket& b = locate(req.id);
+
+    if(b.find(req.id) >= 0) {
+        // known, move to tail and pick up any new address
+        b.update_near_entry(req);
+    } else if(b.size() < b.max_size) {
+        b.add_new(req);
+    } else {
+        // full, wait in the replacement cache until an entry goes stale
+        b.update_cache(req);
+    }
 }
 
+void flat_table::each(std::function<void(bucket&)> fn) {
+    R_LOCK(mutex);
+
+    for(int i = 0; i < hash_t::bits; i++)
+        if(!buckets[i].empty())
+            fn(buckets[i]);
 }
+
+std::vector<net_contact> flat_table::closest(const hash_t& t, std::size_t n) {
+    R_LOCK(mutex);
+
+    std::vector<candidate>& c = scratch();
+
+    // the target's own bucket is nearest to it. every bucket past it is one distance band
+    // from the target, so it's taken whole, then the ones before it, each further than the last
+    int i = index(t);
+    gather(buckets[i], t, c);
+
+    if(c.size() < n)
+        for(int j = i + 1; j < hash_t::bits; j++)
+            gather(buckets[j], t, c);
+
+    for(int j = i - 1; j >= 0 && c.size() < n; j--)
+        gather(buckets[j], t, c);
+
+    return pick(c, n);
 }
 
-#undef TRAVERSE
\ No newline at end of file
+}
+}
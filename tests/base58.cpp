@@ -0,0 +1,64 @@
+#include <boost/multiprecision/cpp_int.hpp>
+
+#include "util.hpp"
+#include "test.h"
+
+using namespace lotus;
+using namespace lotus::dht;
+
+// the codec from before the limb-based one, over the multiprecision ID it worked on
+static std::string reference_encode(const hash_t& h) {
+    unsigned char b[hash_t::bytes];
+    h.to_bytes(b);
+
+    boost::multiprecision::uint256_t v = 0;
+    boost::multiprecision::import_bits(v, b, b + sizeof(b));
+
+    std::string r;
+    while(v > 0) {
+        r.insert(r.begin(), util::b58map[static_cast<int>(v % 58)]);
+        v /= 58;
+    }
+
+    return r;
+}
+
+int main() {
+    hash_reng_t reng(11);
+    std::vector<hash_t> ids;
+
+    ids.push_back(hash_t());
+    ids.push_back(~hash_t());
+
+    for(int i = 0; i < hash_t::bits; i++) {
+        ids.push_back(hash_t().set(i));
+        ids.push_back(hash_t::prefix_mask(i));
+        ids.push_back(~hash_t::prefix_mask(i));
+    }
+
+    for(int i = 0; i < 10000; i++)
+        ids.push_back(util::gen_randomness(reng));
+
+    for(const auto& id : ids) {
+        std::string s = util::b58encode_h(id);
+
+        CHECK(s == reference_encode(id));
+        CHECK(s.size() <= 44);
+        CHECK(util::b58decode_h(s) == id);
+    }
+
+    // zero has no digits, leading '1's are zeros
+    CHECK(util::b58encode_h(hash_t()).empty());
+    CHECK(util::b58decode_h("") == hash_t());
+    CHECK(util::b58decode_h("1112") == util::b58decode_h("2"));
+
+    bool threw = false;
+    try {
+        util::b58decode_h("abc0");
+    } catch(std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,89 @@
+#include "bucket.h"
+#include "routing.h"
+#include "network.h"
+#include "test.h"
+
+using namespace lotus;
+using namespace lotus::dht;
+
+static net_addr at(const std::string& ip, u16 port) {
+    return net_addr("udp", ip, port);
+}
+
+int main() {
+    // never run, it only has to exist for the pings a bucket sends
+    network net(true, 0, [](net_peer, proto::message) { }, 1);
+
+    hash_reng_t reng(3);
+    std::shared_ptr<routing_table> t = std::make_shared<flat_table>(util::gen_randomness(reng), net);
+    t->init();
+
+    bucket b(t);
+    std::vector<hash_t> ids;
+
+    // fills up at k, the rest don't fit
+    for(int i = 0; i < bucket::k + 5; i++) {
+        ids.push_back(util::gen_randomness(reng));
+        b.add_new(net_peer(ids.back(), i & 1 ? at("10.0.0." + std::to_string(i), 1000 + i) : at("::" + std::to_string(i + 1), 1000 + i)));
+    }
+
+    CHECK(b.size() == bucket::k);
+    for(int i = 0; i < bucket::k; i++)
+        CHECK(b.find(ids[i]) == i);
+    CHECK(b.find(ids[bucket::k + 1]) == -1);
+
+    // a known entry moves to the tail and picks up the new address
+    b.update_near_entry(net_peer(ids[3], at("192.168.1.1", 5)));
+    CHECK(b.find(ids[3]) == bucket::k - 1);
+    CHECK(b.find(ids[4]) == 3);
+
+    routing_table_entry e = b.entry(bucket::k - 1);
+    CHECK(e.addresses.size() == 2);
+    CHECK(e.addresses[0].first.addr == "10.0.0.3");
+    CHECK(e.addresses[1].first.addr == "192.168.1.1");
+    CHECK(b.entry(b.find(ids[5])).addresses[0].first.addr == "10.0.0.5");
+
+    // an address that misses too often is dropped, the entry keeps its other one
+    for(int i = 0; i <= proto::missed_pings_allowed + 1; i++)
+        b.stale(net_peer(ids[3], at("10.0.0.3", 1003)));
+
+    e = b.entry(b.find(ids[3]));
+    CHECK(e.addresses.size() == 1);
+    CHECK(e.addresses[0].first.addr == "192.168.1.1");
+
+    // losing its last address erases the entry. the newest candidate is already in the
+    // bucket and is skipped, the next one is only pinged, not added before it answers
+    b.update_cache(net_peer(ids[bucket::k + 2], at("127.0.0.1", 9)));
+    b.update_cache(net_peer(ids[7], at("127.0.0.1", 9)));
+
+    for(int i = 0; i <= proto::missed_pings_allowed + 1; i++)
+        b.stale(net_peer(ids[5], at("10.0.0.5", 1005)));
+
+    CHECK(b.find(ids[5]) == -1);
+    CHECK(b.find(ids[bucket::k + 2]) == -1);
+    CHECK(b.find(ids[7]) >= 0);
+    CHECK(b.size() == bucket::k - 1);
+    CHECK(b.cache.empty());
+
+    // erasing moved the last slot, everyone else is still found
+    for(int i = 0; i < bucket::k; i++)
+        if(i != 5)
+            CHECK(b.find(ids[i]) >= 0);
+
+    b.responded(net_peer(ids[0], at("::1", 1000)));
+    CHECK(b.find(ids[0]) == (int)b.size() - 1);
+
+    // only IP literals fit in a bucket, hostnames are dropped
+    routing_table_entry r(ids[bucket::k + 3], at("8.8.8.8", 53));
+    r.addresses.emplace_back(net_addr("udp", "host.name", 1), 0);
+
+    b.clear();
+    CHECK(b.insert(r));
+    CHECK(b.entry(0).addresses.size() == 1);
+    CHECK(b.entry(0).addresses[0].first.addr == "8.8.8.8");
+
+    b.add_new(net_peer(ids[bucket::k + 4], net_addr("udp", "host.name", 1)));
+    CHECK(b.size() == 1);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+#include "util.hpp"
+#include "test.h"
+
+using namespace lotus;
+using namespace lotus::dht;
+
+using crc_fn = u32 (*)(const void*, std::size_t, u32);
+
+static void check(crc_fn crc) {
+    // check value from the CRC catalogue
+    CHECK(crc("123456789", 9, 0) == 0xE3069283);
+    CHECK(crc("", 0, 0) == 0);
+
+    // iSCSI test vectors, RFC 3720 B.4
+    std::vector<u8> v(32, 0);
+    CHECK(crc(v.data(), v.size(), 0) == 0x8A9136AA);
+
+    std::fill(v.begin(), v.end(), 0xff);
+    CHECK(crc(v.data(), v.size(), 0) == 0x62A8AB43);
+
+    for(int i = 0; i < 32; i++)
+        v[i] = i;
+    CHECK(crc(v.data(), v.size(), 0) == 0x46DD794E);
+
+    // every length and alignment against the bytewise definition, and split anywhere
+    std::vector<u8> data(300);
+    for(std::size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<u8>(i * 131 + 7);
+
+    for(std::size_t off = 0; off < 8; off++) {
+        for(std::size_t len = 0; off + len <= data.size(); len += 1 + len / 16) {
+            u32 c = 0xffffffff;
+            for(std::size_t i = 0; i < len; i++) {
+                c ^= data[off + i];
+                for(int k = 0; k < 8; k++)
+                    c = (c >> 1) ^ (0x82F63B78 & -(c & 1));
+            }
+
+            u32 whole = crc(data.data() + off, len, 0);
+            CHECK(whole == ~c);
+            CHECK(crc(data.data() + off + len / 3, len - len / 3, crc(data.data() + off, len / 3, 0)) == whole);
+        }
+    }
+}
+
+int main() {
+    check(util::crc32c);
+    check(util::crc32c_slicing8);
+
+    if(util::crc32c_has_sse42())
+        check(util::crc32c_sse42);
+    else
+        std::printf("no SSE4.2 here, only the table path was checked\n");
+
+    return failures ? 1 : 0;
+}
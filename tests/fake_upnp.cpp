@@ -0,0 +1,23 @@
+#include "upnp.h"
+
+namespace lotus {
+namespace dht {
+
+// stands in for src/upnp.cpp so tests can build a network without a gateway to talk to
+upnp::upnp(bool) : devlist(nullptr) { }
+upnp::~upnp() { }
+
+bool upnp::forward_port(std::string, t_protocol, u16) {
+    return true;
+}
+
+std::string upnp::get_external_ip_address() {
+    return "127.0.0.1";
+}
+
+std::string upnp::get_local_ip_address() {
+    return "127.0.0.1";
+}
+
+}
+}
@@ -0,0 +1,91 @@
+#include <random>
+#include <vector>
+#include <boost/multiprecision/cpp_int.hpp>
+
+#include "id.h"
+#include "test.h"
+
+using namespace lotus::dht;
+
+// the ID type before node_id
+using big_t = boost::multiprecision::number<
+    boost::multiprecision::cpp_int_backend<256, 256,
+        boost::multiprecision::unsigned_magnitude, boost::multiprecision::unchecked, void>,
+    boost::multiprecision::et_off>;
+
+static big_t big(const node_id& id) {
+    unsigned char b[node_id::bytes];
+    id.to_bytes(b);
+
+    big_t r = 0;
+    boost::multiprecision::import_bits(r, b, b + sizeof(b));
+    return r;
+}
+
+static int clz(const big_t& v) {
+    return v == 0 ? 256 : 255 - (int)boost::multiprecision::msb(v);
+}
+
+int main() {
+    std::mt19937_64 reng(5);
+    std::vector<node_id> ids;
+
+    // edge cases, then IDs sharing prefixes of every length, then random ones
+    node_id ones = ~node_id();
+    ids.push_back(node_id());
+    ids.push_back(ones);
+
+    for(int i = 0; i < node_id::bits; i++) {
+        ids.push_back(node_id().set(i));
+        ids.push_back(node_id::prefix_mask(i));
+    }
+
+    for(int i = 0; i < 1000; i++) {
+        node_id r;
+        for(auto& w : r.w)
+            w = reng();
+
+        ids.push_back(r);
+
+        node_id m = node_id::prefix_mask(i % node_id::bits);
+        ids.push_back((ids[i] & m) | (r & ~m));
+    }
+
+    for(const auto& a : ids) {
+        big_t ba = big(a);
+
+        unsigned char b[node_id::bytes];
+        a.to_bytes(b);
+        CHECK(node_id::from_bytes(b) == a);
+
+        for(int i = 0; i < node_id::bits; i += 7)
+            CHECK(a.bit(i) == boost::multiprecision::bit_test(ba, 255 - i));
+    }
+
+    for(std::size_t i = 0; i < ids.size(); i++) {
+        for(std::size_t j = i; j < ids.size(); j += 1 + j % 13) {
+            const node_id& a = ids[i];
+            const node_id& b = ids[j];
+            big_t ba = big(a), bb = big(b);
+
+            CHECK((a < b) == (ba < bb));
+            CHECK((a == b) == (ba == bb));
+            CHECK((node_id::compare(a, b) > 0) == (ba > bb));
+
+            CHECK(big(a ^ b) == (ba ^ bb));
+            CHECK(big(a & b) == (ba & bb));
+            CHECK((a ^ b).clz() == clz(ba ^ bb));
+
+            const node_id& t = ids[(i * 31 + j) % ids.size()];
+            big_t bt = big(t);
+            CHECK(node_id::closer(a, b, t) == ((ba ^ bt) < (bb ^ bt)));
+        }
+    }
+
+    for(int n = 0; n <= node_id::bits; n++) {
+        big_t m = n == 0 ? big_t(0) : ~big_t(0) << (256 - n);
+        CHECK(big(node_id::prefix_mask(n)) == m);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,81 @@
+#include "crypto.h"
+#include "test.h"
+
+using namespace lotus;
+using namespace lotus::pki;
+
+// records in a keystore file, stops at a torn one like keystore::open does
+static std::size_t records(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    unsigned char len[2];
+    std::size_t n = 0;
+
+    while(in.read((char*)len, sizeof(len)) && in.ignore((len[0] << 8) | len[1]) && in)
+        n++;
+
+    return n;
+}
+
+int main() {
+    std::string path = "test_keystore.keys";
+    std::remove(path.c_str());
+
+    AutoSeededRandomPool rng;
+    std::vector<std::string> keys;
+
+    for(int i = 0; i < 300; i++)
+        keys.push_back(private_key::generate(key_scheme::ed25519, rng)->pub_key());
+
+    std::vector<dht::hash_t> held;
+    std::size_t capacity;
+
+    {
+        keystore ks(64);
+        capacity = ks.capacity();
+        CHECK(ks.open(path) == 0);
+
+        for(const auto& k : keys)
+            ks.put(dht::util::hash(k), k, public_key::load(k));
+
+        CHECK(ks.size() <= ks.capacity());
+        CHECK(ks.evictions() > 0);
+
+        for(const auto& k : keys)
+            if(ks.has(dht::util::hash(k)))
+                held.push_back(dht::util::hash(k));
+
+        CHECK(held.size() == ks.size());
+    }
+
+    // appending past twice the capacity rewrites the file with only the keys held
+    CHECK(records(path) < keys.size());
+    CHECK(records(path) <= 2 * capacity);
+
+    // a restart gets back exactly the keys that were held
+    {
+        keystore ks(64);
+        ks.open(path);
+
+        CHECK(ks.size() == held.size());
+        for(const auto& h : held)
+            CHECK(ks.has(h));
+    }
+
+    // a record torn by a crash mid-append is dropped, the rest still loads
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        out.write("\x01\x00torn", 6);
+    }
+
+    {
+        keystore ks(64);
+        ks.open(path);
+
+        CHECK(ks.size() == held.size());
+        for(const auto& h : held)
+            CHECK(ks.has(h));
+    }
+
+    std::remove(path.c_str());
+    return failures ? 1 : 0;
+}
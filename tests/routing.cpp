@@ -0,0 +1,66 @@
+#include "routing.h"
+#include "network.h"
+#include "test.h"
+
+using namespace lotus;
+using namespace lotus::dht;
+
+// closest() has to agree with sorting the whole table by distance
+static void check_closest(std::shared_ptr<routing_table> t, hash_t self, hash_reng_t& reng) {
+    t->init();
+
+    // half the peers share a prefix with us so the trie splits deep
+    for(int i = 0; i < 20000; i++) {
+        hash_t r = util::gen_randomness(reng);
+
+        if(i & 1) {
+            hash_t m = hash_t::prefix_mask(i % 40);
+            r = (self & m) | (r & ~m);
+        }
+
+        t->update(net_peer(r, net_addr("udp", "10.0.0.1", 1000 + i % 60000)));
+    }
+
+    std::vector<hash_t> all;
+    t->each([&](bucket& b) {
+        for(std::size_t i = 0; i < b.size(); i++)
+            all.push_back(b.id(i));
+    });
+
+    CHECK(all.size() > proto::bucket_size);
+
+    for(int q = 0; q < 2000; q++) {
+        hash_t target = q == 0 ? self : util::gen_randomness(reng);
+
+        if(q & 1) {
+            hash_t m = hash_t::prefix_mask(q % 30);
+            target = (self & m) | (target & ~m);
+        }
+
+        std::vector<hash_t> sorted = all;
+        std::sort(sorted.begin(), sorted.end(), [&](const hash_t& a, const hash_t& b) {
+            return hash_t::closer(a, b, target);
+        });
+
+        for(std::size_t n : { (std::size_t)proto::alpha, (std::size_t)proto::bucket_size }) {
+            std::vector<net_contact> got = t->closest(target, n);
+
+            CHECK(got.size() == std::min(n, sorted.size()));
+            for(std::size_t i = 0; i < got.size() && i < sorted.size(); i++)
+                CHECK(got[i].id == sorted[i]);
+        }
+    }
+}
+
+int main() {
+    // never run, the tables only need one to exist
+    network net(true, 0, [](net_peer, proto::message) { }, 1);
+
+    hash_reng_t reng(7);
+    hash_t self = util::gen_randomness(reng);
+
+    check_closest(std::make_shared<trie_table>(self, net), self, reng);
+    check_closest(std::make_shared<flat_table>(self, net), self, reng);
+
+    return failures ? 1 : 0;
+}
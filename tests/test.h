@@ -0,0 +1,16 @@
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <cstdio>
+
+// tests are plain executables. a failed check is reported and the test exits nonzero
+static int failures = 0;
+
+#define CHECK(c) do { \
+    if(!(c)) { \
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); \
+        failures++; \
+    } \
+} while(0)
+
+#endif